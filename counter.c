@@ -1,6 +1,8 @@
 #include "counter.h"
 
 int main(int argc, char* argv[]) {
+    if (!parse_options(argc, argv))
+        return 1;
     main_counter_function();
     return 0;
-}
\ No newline at end of file
+}
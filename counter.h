@@ -14,35 +14,63 @@ Data race в windows устраняется с помощью mutex;
 Atomic не обязательно работает межпроцессно
 
 Закрытие процесса после нажатия на enter в терминале
-происходит с помощью volatile BOOL флажка
+происходит с помощью атомарного флажка quit_flag и eventfd 
+shutdown_fd, который мгновенно будит все ждущие потоки
 */
 
 
 
 #ifndef _WIN32
-#define _POSIX_C_SOURCE 200809L // Гарантирует доступ к sem_open, shm_open и прочему
+#define _POSIX_C_SOURCE 200809L // Гарантирует доступ к shm_open и прочему
+#define _DEFAULT_SOURCE         // syscall() для futex
 #endif
 
 #include <time.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdatomic.h>
+#include <stdint.h>
 #include <string.h>
+#include <stdarg.h>
 
 #ifdef _WIN32
     #include <windows.h>
     #include <memoryapi.h>
+    #include <io.h>
 #else // POSIX
     #include <unistd.h>
     #include <sys/types.h>
     #include <sys/file.h>
+    #include <fcntl.h>
     #include <sys/wait.h> 
     #include <sys/mman.h>
     #include <pthread.h>
-    #include <semaphore.h>
+    #include <sched.h>
     #include <errno.h> 
     #include <ctype.h> 
     #include <signal.h> 
+    #include <poll.h>
+    #include <sys/signalfd.h>
+    #include <sys/eventfd.h>
+    #include <sys/epoll.h>
+    #include <sys/timerfd.h>
+    #include <sys/inotify.h>
+    #include <sys/socket.h>
+    #include <sys/un.h>
+    #include <netinet/in.h>
+    #include <arpa/inet.h>
+    #include <sys/stat.h>
+    #include <sys/syscall.h>
+    #include <linux/futex.h>
+    #include <limits.h>
+#endif
+
+// Счетчик тактов (TSC) есть только на x86; читаем его встроенными 
+// функциями GCC (MinGW тоже их поддерживает)
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+    #define HAVE_TSC
+    #include <x86intrin.h>
+    #include <cpuid.h>
 #endif
 
 
@@ -64,52 +92,708 @@ Atomic не обязательно работает межпроцессно
     }
 #endif
 
-#define LOG_FILE "counter.log"
+// Симуляция (COUNTER_SIM, см. counter_sim.c): время, PID и процессы 
+// виртуальные, поэтому сутки работы проигрываются за секунды и 
+// каждый прогон повторяется один в один
+#ifdef COUNTER_SIM
+    #ifdef _WIN32
+        #error "COUNTER_SIM is supported only on POSIX"
+    #endif
+    #undef get_current_pid
+    #define get_current_pid()   sim_pid
+    #define sleep_ms(ms)        sim_sleep_ms(ms)
+#endif
+
+// Статические точки трассировки (USDT) для perf и bpftrace: 
+// пока к ним никто не подключился, на их месте стоит один nop. 
+// COUNTER_USDT (экспериментально, по умолчанию выключено) выставляет 
+// CMake, если есть <sys/sdt.h>; иначе точки не компилируются вовсе 
+// (аргументы тоже не вычисляются, поэтому в них можно обращаться 
+// к полям, которых нет под Windows)
+#if defined(COUNTER_USDT) && !defined(_WIN32)
+    #include <sys/sdt.h>
+    #define COUNTER_PROBE(name)                 DTRACE_PROBE(counter, name)
+    #define COUNTER_PROBE1(name, a)             DTRACE_PROBE1(counter, name, a)
+    #define COUNTER_PROBE2(name, a, b)          DTRACE_PROBE2(counter, name, a, b)
+    #define COUNTER_PROBE3(name, a, b, c)       DTRACE_PROBE3(counter, name, a, b, c)
+#else
+    #define COUNTER_PROBE(name)                 do {} while (0)
+    #define COUNTER_PROBE1(name, a)             do {} while (0)
+    #define COUNTER_PROBE2(name, a, b)          do {} while (0)
+    #define COUNTER_PROBE3(name, a, b, c)       do {} while (0)
+#endif
+
+#ifdef COUNTER_SIM
+    #define LOG_FILE "counter_sim.log"  // лог симуляции не смешивается с настоящим
+#else
+    #define LOG_FILE "counter.log"
+#endif
+#define CONFIG_FILE "counter.conf"
+#define CONTROL_SOCKET "counter.sock"
+#define NAMESPACE_ENV "COUNTER_NAMESPACE"   // суффикс имен общих объектов и файлов (см. shared_name)
+#define NAME_SIZE 128
 #define TIME_STR_SIZE 32
-#define MAIN_CYCLE_DELAY 20         // in ms
+// Значения по умолчанию; во время работы действуют значения 
+// из RuntimeConfig, которые можно поменять в CONFIG_FILE
+#define MAIN_CYCLE_DELAY 20         // in ms, шаг опроса там, где нет событий (Windows)
 #define INCREMENT_DELAY 300         // in ms
 #define LOG_COUNTER_DELAY 1000      // in ms
 #define LAUNCH_COPIES_DELAY 3000    // in ms
 #define COPY2_DELAY 2000            // in ms
+#define MIN_LAUNCH_INTERVAL 100     // in ms, нижняя граница адаптивного темпа
+#define MAX_LAUNCH_INTERVAL LAUNCH_COPIES_DELAY // in ms, верхняя граница адаптивного темпа
+#define PACER_EWMA_WEIGHT 0.2       // вес нового замера в скользящем среднем
+#define WHEEL_TICK 1                // in ms, разрешение колеса таймеров
+#define WHEEL_BITS 8                // 256 ячеек на уровень
+#define WHEEL_LEVELS 4              // 4 уровня покрывают 2^32 тиков (~49 дней)
+#define WHEEL_SIZE (1 << WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SIZE - 1)
+#define LATENESS_BUCKETS 24         // корзина i: опоздание меньше 2^i мкс
+#define STAT_SUB_BITS 3             // 8 линейных корзин на каждую степень двойки
+#define STAT_MAX_BITS 40            // значения от 2^40 нс (~18 мин) — в последней корзине
+#define STAT_BUCKETS ((STAT_MAX_BITS - STAT_SUB_BITS + 1) << STAT_SUB_BITS)
+#define HF_SLEEP_QUANTUM 50000      // in ns, как часто просыпается высокочастотный инкремент
+#define HF_MAX_RATE 1000000000     // increments/s, верхняя граница --hf-rate
+#define CONTROL_MSG_SIZE 9          // 1 байт операции/статуса + 8 байт значения
+#define CONTROL_IN_SIZE 4096        // in bytes, входной буфер клиента
+#define CONTROL_OUT_SIZE 16384      // in bytes, выходной буфер клиента
+#define CONTROL_WATCH_POLL 100      // in ms, как часто поток подписок проверяет, есть ли подписчики
+#define MAX_CONTROL_CLIENTS 256
+#define CONTROL_TAG 1ULL            // метка событий управления в epoll_event.data
+#define METRICS_TAG 2ULL            // метка событий HTTP-метрик в epoll_event.data
+#define METRICS_REFRESH 1000        // in ms, как часто лидер обновляет снимок метрик
+#define METRICS_IN_SIZE 2048        // in bytes, заголовок HTTP-запроса
+#define METRICS_OUT_SIZE 8192       // in bytes, ответ целиком
+#define MAX_METRICS_CLIENTS 16
+#define TRACE_ENV "COUNTER_TRACE"   // переменная окружения: папка для файлов трассировки
+#define TRACE_BUFFER_EVENTS (1 << 18)   // событий на процесс, остальные отбрасываются
+#define TRACE_MAGIC 0x43545243      // "CRTC"
+#define FAST_CLOCK_CALIBRATION 20   // in ms, сколько длится калибровка TSC
+#define FAST_CLOCK_ENV "COUNTER_CLOCK"  // "monotonic" — не использовать TSC
+#define FAST_CLOCK_NO_TSC UINT64_MAX    // в /CounterStats: TSC проверен и не годится
+#define LOCK_INIT_TIMEOUT 1000      // in ms, сколько ждать, пока другой процесс создаст мьютекс
+#define SIM_EPOCH 1704067200       // in s, 2024-01-01 00:00:00 UTC — начало виртуального времени
+#define SIM_FIRST_PID 1000          // первый виртуальный PID
+#define SIM_MAX_PROCESSES 256       // одновременно живых виртуальных процессов
+#define SIM_SPAWN_COST 500          // in us, сколько по умолчанию длится запуск копии
+#define MAX_COPY_JOBS 16            // максимум одновременных копий одной роли
+#define MAX_COPY_QUEUE 64           // максимум ожидающих запуска копий одной роли
+#define BATCH_CHUNK_SIZE (1 << 20)  // сколько байт пакетный ввод читает за раз
+#define TERMINAL_BUFFER_SIZE 64     // длиннее строка ввода с терминала быть не может
+#define BATCH_LINE_SIZE 64          // длиннее строка команды быть не может
 #define counter_t unsigned long long
 
+typedef struct {
+    int main_cycle_delay;       // in ms
+    int increment_delay;        // in ms
+    int log_counter_delay;      // in ms
+    int launch_copies_delay;    // in ms
+    int copy2_delay;            // in ms
+} RuntimeConfig;
+
 typedef struct {
     counter_t counter;
     long leader_pid;
+    atomic_ullong leader_since_ns;  // когда leader_pid стал лидером (get_curr_time_ns)
+
+    // Уведомления об изменении counter: change_seq увеличивается после 
+    // каждого изменения, а ждущие спят на нем как на futex. 
+    // change_waiters — сколько их, чтобы без ждущих не делать syscall
+    atomic_uint change_seq;
+    atomic_uint change_waiters;
+
+#ifndef _WIN32
+    // Блокировка данных (lockData): надежный (robust) мьютекс между 
+    // процессами. Если владельца убили, ядро отдает мьютекс следующему 
+    // ждущему с EOWNERDEAD. lock_state — создан ли он (LOCK_STATE_*)
+    pthread_mutex_t lock;
+    atomic_uint lock_state;
+#endif
+    // Процесс, держащий блокировку, 0 — никто. Только для наблюдения 
+    // (counter_chaos, сообщение о восстановлении): пишется после захвата
+    atomic_long lock_owner;
+
+    // Настройки, общие для всех экземпляров. Меняются только под 
+    // lockData() вместе с увеличением config_version, так что 
+    // экземпляру достаточно сравнить номер версии со своим.
+    atomic_uint config_version;
+    RuntimeConfig config;
 } SharedData;
 
+enum {
+    LOCK_STATE_NONE,        // память только что создана (нули)
+    LOCK_STATE_INIT,        // какой-то процесс создает мьютекс
+    LOCK_STATE_READY
+};
+
+// Функции ниже нужны и counter, и libcounter, поэтому определены здесь
+
+static inline long long shared_clock_ms() {
+#ifdef _WIN32
+    return (long long) GetTickCount64();
+#else // POSIX
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000LL + now.tv_nsec / 1000000;
+#endif
+}
+
+static inline char* shared_name(const char* base, char* buf, size_t size) {
+    // С NAMESPACE_ENV=ns имена получают суффикс: /SharedData-ns, 
+    // counter-ns.log. Экземпляры с другим ns (или без него) их не 
+    // видят, поэтому замеры и проверки не трогают настоящий счетчик
+    const char* ns = getenv(NAMESPACE_ENV);
+    if (!ns || !*ns) {
+        snprintf(buf, size, "%s", base);
+        return buf;
+    }
+    const char* ext = strrchr(base, '.');
+    if (!ext)
+        ext = base + strlen(base);
+    snprintf(buf, size, "%.*s-%s%s", (int) (ext - base), base, ns, ext);
+    return buf;
+}
+
+static inline counter_t shared_counter_load(SharedData* d) {
+    // counter — выровненное 64-битное слово, читается атомарно без блокировки
+    return atomic_load_explicit((_Atomic counter_t*) &d->counter, memory_order_acquire);
+}
+
+static inline void shared_counter_changed(SharedData* d) {
+    // Вызывается после каждого изменения counter. Будит всех ждущих; 
+    // несколько изменений подряд склеиваются в одно пробуждение
+    atomic_fetch_add(&d->change_seq, 1);
+#ifndef _WIN32
+    if (atomic_load(&d->change_waiters) > 0)
+        syscall(SYS_futex, &d->change_seq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+#endif
+}
+
+#ifndef _WIN32
+static inline BOOL shared_lock_ready(SharedData* d, BOOL create) {
+    // Мьютекс живет в самой /SharedData. Создает его первый процесс 
+    // (create), остальные ждут готовности не дольше LOCK_INIT_TIMEOUT
+    unsigned int state = LOCK_STATE_NONE;
+    if (create && atomic_compare_exchange_strong(&d->lock_state, &state, LOCK_STATE_INIT)) {
+        pthread_mutexattr_t attr;
+        pthread_mutexattr_init(&attr);
+        pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+        pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+        int rc = pthread_mutex_init(&d->lock, &attr);
+        pthread_mutexattr_destroy(&attr);
+        atomic_store(&d->lock_state, rc == 0 ? LOCK_STATE_READY : LOCK_STATE_NONE);
+        return rc == 0;
+    }
+
+    long long deadline = shared_clock_ms() + LOCK_INIT_TIMEOUT;
+    while (atomic_load(&d->lock_state) != LOCK_STATE_READY) {
+        if (shared_clock_ms() > deadline)
+            return FALSE;
+        sched_yield();
+    }
+    return TRUE;
+}
+
+static inline int shared_lock_acquire(SharedData* d, BOOL try_only, long* recovered_from) {
+    // 0 — мьютекс наш, EBUSY (для try_only) — занят, иначе ошибка. 
+    // Мьютекс умершего владельца приходит с EOWNERDEAD: counter — 
+    // одно слово, недописанного состояния нет, поэтому просто 
+    // помечаем мьютекс согласованным и сообщаем, чей он был
+    int rc = try_only ? pthread_mutex_trylock(&d->lock) : pthread_mutex_lock(&d->lock);
+    if (rc == EOWNERDEAD) {
+        if (recovered_from)
+            *recovered_from = atomic_load(&d->lock_owner);
+        rc = pthread_mutex_consistent(&d->lock);
+    }
+    return rc;
+}
+#endif
+
+static inline BOOL shared_counter_wait(SharedData* d, counter_t last, counter_t* value, int timeout_ms) {
+    // Ждет, пока counter станет отличным от last, не дольше timeout_ms 
+    // (-1 — без ограничения). Ждущий видит последнее значение, а не 
+    // каждое изменение. В Windows futex между процессами нет — там опрос
+    long long deadline = shared_clock_ms() + timeout_ms;
+    BOOL changed = FALSE;
+
+    atomic_fetch_add(&d->change_waiters, 1);
+    for (;;) {
+        // Номер берется до проверки значения: изменение после проверки 
+        // увеличит change_seq, и FUTEX_WAIT сразу вернется
+        unsigned int seq = atomic_load(&d->change_seq);
+        counter_t current = shared_counter_load(d);
+        if (value)
+            *value = current;
+        if (current != last) {
+            changed = TRUE;
+            break;
+        }
+
+        long long left_ms = -1;
+        if (timeout_ms >= 0) {
+            left_ms = deadline - shared_clock_ms();
+            if (left_ms <= 0)
+                break;
+        }
+#ifdef _WIN32
+        Sleep(1);
+        (void) seq;
+#else // POSIX
+        struct timespec timeout;
+        timeout.tv_sec = left_ms / 1000;
+        timeout.tv_nsec = (left_ms % 1000) * 1000000;
+        syscall(SYS_futex, &d->change_seq, FUTEX_WAIT, seq, 
+            (left_ms >= 0) ? &timeout : NULL, NULL, 0);
+#endif
+    }
+    atomic_fetch_sub(&d->change_waiters, 1);
+    return changed;
+}
+
 typedef struct {
 #ifdef _WIN32
     HANDLE hProcess;
 #else // POSIX
     unsigned int pid;
 #endif
+    BOOL completed;     // процесс уже завершился (и в POSIX собран waitpid)
+    int role;
+    BOOL is_thread;     // копия работает потоком внутри лидера
+    atomic_int thread_done;
 } app_info;
 
+typedef struct {
+    // Срок очередного срабатывания периодической задачи основного 
+    // цикла. В POSIX за сроком следит timerfd, который будит цикл.
+    double deadline;        // in ms, CLOCK_MONOTONIC; 0 — таймер выключен
+#ifndef _WIN32
+    int fd;
+#endif
+} loop_timer;
+
+typedef enum {
+    // Что делать периодической задаче, если она пропустила сроки
+    CATCH_UP_SKIP,      // сработать один раз, пропущенные сроки отбросить
+    CATCH_UP_BURST,     // сработать за каждый пропущенный срок подряд
+    CATCH_UP_COALESCE,  // сработать один раз, передав число сроков в runs
+} catch_up_policy;
+
+typedef struct {
+    // Гистограмма опозданий задачи относительно ее срока
+    unsigned long long buckets[LATENESS_BUCKETS];
+    unsigned long long count;
+    double total;   // in ms
+    double max;     // in ms
+} lateness_histogram;
+
+// Общая статистика задержек (/CounterStats). Каждый процесс пишет 
+// в нее relaxed-атомиками, counter_stat читает на ходу
+typedef enum {
+    STAT_LOCK_WAIT,     // ожидание в lockData
+    STAT_LOG_WRITE,     // log_msg целиком
+    STAT_SPAWN,         // запуск копии (launch_copy)
+    STAT_COPY_JOB,      // от запуска копии до ее сбора
+    STAT_LOOP_LATENESS, // опоздание периодических задач основного цикла
+    STAT_COUNT
+} stat_id;
+
+typedef struct {
+    // Лог-линейная гистограмма в наносекундах: значения меньше 
+    // 2^STAT_SUB_BITS — каждое в своей корзине, дальше каждая степень 
+    // двойки делится на 2^STAT_SUB_BITS равных корзин (ошибка < 12.5%)
+    // Число замеров — сумма корзин, отдельного счетчика нет: 
+    // на горячем пути (lockData) каждый атомик на счету
+    atomic_ullong buckets[STAT_BUCKETS];
+    atomic_ullong total_ns;
+    atomic_ullong max_ns;
+} stat_histogram;
+
+// Общие счетчики событий (/CounterStats, рядом с гистограммами). 
+// Переживают смену лидера, поэтому их и отдает /metrics
+typedef enum {
+    EVENT_INCREMENTS,       // инкременты счетчика (обычные и высокочастотные)
+    EVENT_LEADER_CHANGES,   // смены лидера
+    EVENT_COPY1_LAUNCHED,   // запуски копий, по роли: см. scheduler_count
+    EVENT_COPY2_LAUNCHED,
+    EVENT_COPY1_COMPLETED,
+    EVENT_COPY2_COMPLETED,
+    EVENT_COPY1_DROPPED,    // запуск пропущен: очередь копий заполнена
+    EVENT_COPY2_DROPPED,
+    EVENT_LAUNCH_BUSY,      // срок запуска наступил, а прошлые копии еще работают
+    EVENT_LOG_BYTES,        // байт записано в LOG_FILE (строк — замеры log_write)
+    EVENT_LOCK_RECOVERIES,  // блокировка получена от убитого владельца
+    EVENT_COUNT
+} event_id;
+
+typedef struct {
+    stat_histogram hist[STAT_COUNT];
+    atomic_ullong events[EVENT_COUNT];
+
+    // Частота TSC, измеренная первым процессом (см. initFastClock): 
+    // tsc_ticks тактов за tsc_ns наносекунд. 0 — еще не измерена, 
+    // FAST_CLOCK_NO_TSC — TSC на этой машине для часов не годится
+    atomic_ullong tsc_ticks;
+    atomic_ullong tsc_ns;
+} CounterStats;
+
+typedef struct {
+    // Быстрые часы для замеров длительности: TSC, пересчитанный в 
+    // наносекунды по CLOCK_MONOTONIC. Без надежного TSC — get_curr_time_ns
+    BOOL use_tsc;
+    uint64_t tsc_base;
+    uint64_t ns_base;
+    double ns_per_tick;
+} fast_clock_state;
+
+typedef struct {
+    // Снимок stat_histogram (или разность двух снимков) для расчетов
+    unsigned long long buckets[STAT_BUCKETS];
+    unsigned long long count;
+    unsigned long long total_ns;
+    unsigned long long max_ns;
+} stat_snapshot;
+
+// Трассировка (включается переменной TRACE_ENV). Каждый процесс 
+// пишет события в свой буфер, при выходе сбрасывает его в файл 
+// trace-PID.bin, а counter_trace собирает файлы в JSON для 
+// chrome://tracing и Perfetto
+typedef enum {
+    TRACE_LOCK_WAIT,    // ожидание блокировки данных
+    TRACE_LOCK_HELD,    // блокировка данных захвачена
+    TRACE_LOG_WRITE,    // log_msg
+    TRACE_SPAWN,        // fork (или создание потока) копии у лидера
+    TRACE_COPY_WORK,    // работа копии целиком, value — роль
+    TRACE_COPY2_SLEEP,  // пауза копии 2 (COPY2_DELAY)
+    TRACE_LAUNCH_BUSY,  // мгновенное: срок запуска, а прошлые копии еще работают
+    TRACE_KIND_COUNT
+} trace_kind;
+
+typedef struct {
+    uint64_t start_ns;  // по get_curr_time_ns — общие часы для всех процессов
+    uint64_t dur_ns;
+    uint64_t value;
+    uint32_t tid;
+    uint32_t kind;
+} trace_event;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t pid;
+    char role[16];
+    uint64_t count;
+    uint64_t dropped;
+} trace_file_header;
+
+// Протокол управления через CONTROL_SOCKET. Запрос и ответ — по 
+// CONTROL_MSG_SIZE байт: код операции (или статус) и значение 
+// счетчика (little-endian). Запросы можно слать пачкой, не дожидаясь 
+// ответов; ответы приходят в том же порядке.
+typedef enum {
+    CONTROL_GET = 1,    // прочитать значение
+    CONTROL_SET = 2,    // установить значение
+    CONTROL_ADD = 3,    // прибавить значение (по модулю 2^64)
+    CONTROL_WATCH = 4,  // прочитать значение и подписаться на изменения
+} control_op;
+
+typedef enum {
+    CONTROL_OK = 0,     // ответ на запрос, значение — счетчик после операции
+    CONTROL_ERROR = 1,  // неизвестная операция
+    CONTROL_EVENT = 2,  // уведомление подписчику: счетчик изменился
+} control_status;
+
+typedef struct {
+    int fd;
+    int index;
+    BOOL watching;
+    uint32_t epoll_events;  // чего ждем в epoll: EPOLLIN, EPOLLOUT или ничего
+    counter_t last_value;   // последнее отправленное подписчику значение
+    unsigned char in[CONTROL_IN_SIZE];
+    size_t in_len;
+    unsigned char out[CONTROL_OUT_SIZE];
+    size_t out_len;
+} control_client;
+
+typedef struct {
+    // Клиент HTTP-метрик: читаем заголовок запроса, 
+    // отдаем ответ целиком и закрываем соединение
+    int fd;
+    int index;
+    char in[METRICS_IN_SIZE];
+    size_t in_len;
+    char out[METRICS_OUT_SIZE];
+    size_t out_len;
+    size_t out_pos;
+} metrics_client;
+
+typedef struct {
+    // Снимок для /metrics. Лидер обновляет его в основном цикле раз 
+    // в METRICS_REFRESH; запрос только форматирует снимок, поэтому 
+    // не берет блокировку и не трогает разделяемую память
+    BOOL valid;
+    double taken_at;            // in ms
+    counter_t value;
+    long leader_pid;
+    unsigned long long events[EVENT_COUNT];
+    double increments_rate;     // increments/s между двумя последними снимками
+    unsigned long long log_lines;
+    unsigned long long lock_acquisitions;
+    unsigned long long lock_contended;  // ждали дольше попытки без ожидания
+    unsigned long long lock_wait_ns;
+    unsigned long long scrapes;
+} metrics_snapshot;
+
+typedef struct wheel_timer wheel_timer;
+typedef void (*wheel_callback)(wheel_timer* t, void* arg);
+
+struct wheel_timer {
+    // Задача колеса таймеров. Память под нее выделяет вызывающий, 
+    // поэтому регистрация и отмена не требуют выделений.
+    wheel_timer* next;
+    wheel_timer** pprev;    // адрес указателя, который указывает на нас
+    uint64_t expires;       // in ticks
+    uint64_t period;        // in ticks, 0 — одноразовая задача
+    uint64_t first_expires; // in ticks, первый срок (для подсчета ожидаемых срабатываний)
+    catch_up_policy policy;
+    unsigned long long runs;        // сколько сроков покрывает текущий вызов
+    unsigned long long total_runs;  // сколько сроков обработано всего
+    unsigned long long skipped;     // сколько сроков отброшено (CATCH_UP_SKIP)
+    lateness_histogram* lateness;   // NULL — опоздания не считаем
+    int level;
+    int slot;
+    BOOL active;
+    wheel_callback func;
+    void* arg;
+};
+
+typedef struct {
+    // Иерархическое колесо таймеров: на уровне L ячейка покрывает 
+    // 2^(8L) тиков. Задача попадает на уровень по удаленности срока 
+    // и спускается ниже (cascade), когда до нее доходит очередь.
+    // Регистрация, отмена и срабатывание — O(1).
+    wheel_timer* slots[WHEEL_LEVELS][WHEEL_SIZE];
+    uint64_t occupied[WHEEL_LEVELS][WHEEL_SIZE / 64];  // непустые ячейки
+    uint64_t current;       // следующий необработанный тик
+    double origin;          // in ms, момент нулевого тика
+    size_t count;
+} timer_wheel;
+
+typedef struct {
+    app_info* app;
+    double enqueue_time;    // in ms
+    double launch_time;     // in ms
+} copy_job;
+
+typedef struct {
+    // Планировщик копий одной роли: держит до max_in_flight 
+    // запущенных копий и до max_queued ожидающих запуска
+    int role;
+    int max_in_flight;
+    int max_queued;
+
+    copy_job in_flight[MAX_COPY_JOBS];
+    int in_flight_count;
+    double queue[MAX_COPY_QUEUE];   // время постановки в очередь, in ms
+    int queue_head;
+    int queue_count;
+
+    // Статистика
+    double start_time;
+    unsigned long long launched;
+    unsigned long long completed;
+    unsigned long long dropped;
+    double total_latency;
+    double max_latency;
+    double total_queue_wait;
+    double max_queue_wait;
+} copy_scheduler;
+
+typedef struct {
+    // Темп запуска копий. В фиксированном режиме копии запускаются 
+    // раз в LAUNCH_COPIES_DELAY, в адаптивном — сразу после 
+    // завершения предыдущих, но не чаще min_interval и не реже 
+    // max_interval
+    BOOL adaptive;
+    double min_interval;        // in ms
+    double max_interval;        // in ms
+
+    double last_launch;         // in ms
+    BOOL awaiting_completion;   // ждем завершения последнего запуска
+    double avg_completion;      // скользящее среднее времени работы копий, in ms
+
+    // Статистика
+    unsigned long long launches;
+    unsigned long long forced_launches;  // запуски по max_interval, пока копии еще работали
+    double total_interval;
+} launch_pacer;
+
+typedef struct {
+    // Высокочастотный инкремент: отдельный поток добавляет к счетчику 
+    // столько, сколько положено по времени, пачками по одной блокировке
+    double rate;            // increments/s
+    BOOL spin;              // ждать в цикле, а не clock_nanosleep
+    double duration;        // in ms, 0 — до завершения программы
+    unsigned long long done;        // сколько инкрементов сделано
+    unsigned long long batches;     // сколько раз брали блокировку
+    double elapsed;         // in ms
+    atomic_int finished;
+} hf_increment;
+
+typedef struct {
+    // Итог применения пачки команд: любая последовательность set/add 
+    // сворачивается в "присвоить set_value (если был set), затем прибавить add"
+    BOOL has_set;
+    counter_t set_value;
+    counter_t add;
+    unsigned long long commands;
+    unsigned long long invalid;
+} batch_result;
+
+typedef struct {
+    int copy_concurrency;   // сколько копий каждой роли может работать одновременно
+    int copy_queue_limit;   // сколько запусков каждой роли может ждать в очереди
+    BOOL thread_copies;     // запускать копии потоками, а не процессами
+    catch_up_policy increment_catch_up; // как догонять пропущенные инкременты
+    double hf_rate;         // increments/s; 0 — обычный инкремент раз в INCREMENT_DELAY
+    BOOL hf_spin;           // высокочастотный инкремент ждет в цикле
+    BOOL adaptive_pacing;   // адаптивный темп запуска копий
+    int min_launch_interval;    // in ms
+    int max_launch_interval;    // in ms
+    char* batch_path;       // файл команд ("-" — stdin), NULL — обычный ввод с терминала
+    int metrics_port;       // порт HTTP-метрик на 127.0.0.1, 0 — выключены
+} counter_options;
+
+typedef struct {
+    // Состояние основного цикла, доступное задачам колеса таймеров
+    timer_wheel wheel;
+    wheel_timer incr_task;
+    wheel_timer log_task;
+    wheel_timer launch_task;
+    wheel_timer metrics_task;
+    lateness_histogram incr_lateness;
+    lateness_histogram log_lateness;
+    copy_scheduler copy_1_jobs;
+    copy_scheduler copy_2_jobs;
+    launch_pacer pacer;
+    BOOL is_leader;
+} counter_loop;
+
+typedef struct {
+    // Виртуальный процесс симуляции: экземпляр counter (role 0) 
+    // или копия. Копия делает следующий шаг в wake_ns
+    long pid;
+    long parent;
+    int role;
+    int step;
+    uint64_t wake_ns;
+} sim_process;
+
+
 
+// Библиотеке (libcounter.c) нужны только типы и константы выше
+#ifndef COUNTER_DECLS_ONLY
 
-volatile BOOL quit_flag = FALSE;
+atomic_int quit_flag = FALSE;
+atomic_uint_least64_t shutdown_requested_ns = 0;   // когда пришел запрос на завершение
 SharedData* data;
+CounterStats* stats = NULL;     // NULL — статистика не ведется
+fast_clock_state fast_clock = { FALSE, 0, 0, 0 };
+// Локальная копия настроек из SharedData::config
+RuntimeConfig config = {
+    MAIN_CYCLE_DELAY,
+    INCREMENT_DELAY,
+    LOG_COUNTER_DELAY,
+    LAUNCH_COPIES_DELAY,
+    COPY2_DELAY,
+};
+unsigned int config_version = 0;
+BOOL config_file_changed = FALSE;
+counter_options options = {
+    1,  // copy_concurrency
+    1,  // copy_queue_limit
+    FALSE,  // thread_copies
+    CATCH_UP_COALESCE,  // increment_catch_up
+    0,      // hf_rate
+    FALSE,  // hf_spin
+    FALSE,  // adaptive_pacing
+    MIN_LAUNCH_INTERVAL,
+    MAX_LAUNCH_INTERVAL,
+    NULL,   // batch_path
+    0,      // metrics_port
+};
+// Передавать ли дочерним процессам уже открытые дескрипторы
+// (иначе копии заново открывают объекты по имени)
+BOOL inherit_handles = TRUE;
 
 #ifdef _WIN32
     HANDLE SharedData_hMap = NULL;
     HANDLE hDataMutex = NULL;
+    HANDLE Stats_hMap = NULL;
 #else // POSIX
     int shm_fd = -1;
-    sem_t* shm_sem = NULL;
+    int stats_fd = -1;          // /CounterStats, остается открытым для передачи копиям
+    long lock_pid = 0;          // getpid() для lock_owner (getpid — системный вызов)
+    int child_events_fd = -1;   // signalfd для SIGCHLD
+    int wake_fd = -1;           // eventfd, будит основной цикл (например, при завершении копии-потока)
+    int shutdown_fd = -1;       // eventfd, сообщает всем потокам о завершении; 
+                                // у копий-процессов — signalfd для SIGTERM
+    int loop_fd = -1;           // epoll основного цикла
+    int config_watch_fd = -1;   // inotify, следит за CONFIG_FILE
+    int config_file_wd = -1;    // слежка за самим CONFIG_FILE (если он есть)
+    int control_listen_fd = -1; // сокет управления (слушает только лидер)
+    ino_t control_socket_ino = 0;   // inode файла сокета, который создал этот процесс
+    control_client* control_clients[MAX_CONTROL_CLIENTS];
+    atomic_int control_watchers = 0;
+    atomic_int control_watch_running = FALSE;   // поток control_watch_func запущен
+    int metrics_listen_fd = -1; // HTTP-метрики (слушает только лидер)
+    metrics_client* metrics_clients[MAX_METRICS_CLIENTS];
+#endif
+metrics_snapshot metrics;
+// Выключенная трассировка стоит одной проверки trace_enabled
+BOOL trace_enabled = FALSE;
+char* trace_dir = NULL;
+char trace_role[16] = "";
+trace_event* trace_events = NULL;
+atomic_uint trace_next = 0;
+atomic_uint trace_dropped = 0;
+_Thread_local uint64_t trace_lock_acquired = 0;   // когда этот поток взял блокировку данных
+unsigned long long loop_wakeups = 0;    // сколько раз просыпался основной цикл
+#ifdef COUNTER_SIM
+uint64_t sim_now_ns = 0;        // виртуальное время; в логе — от SIM_EPOCH
+long sim_pid = SIM_FIRST_PID;   // процесс, от имени которого сейчас выполняется код
+long sim_next_pid = SIM_FIRST_PID;
+uint64_t sim_spawn_ns = SIM_SPAWN_COST * 1000ULL;
+sim_process sim_processes[SIM_MAX_PROCESSES];   // только живые, в порядке запуска
+int sim_process_count = 0;
 #endif
 
 
 
 double get_curr_time();
+uint64_t get_curr_time_ns();
+uint64_t read_tsc();
+BOOL tsc_is_reliable();
+void read_clock_pair(uint64_t* tsc, uint64_t* ns);
+void initFastClock();
+uint64_t get_fast_time_ns();
+void sleep_until_ns(uint64_t deadline);
 char* get_time_str();
 void log_msg(char* msg);
 void log_counter_val();
 char* trimspaces(char *str);
+BOOL parse_int_option(char* name, char* str, long min, long max, int* value);
+BOOL parse_options(int argc, char* argv[]);
 
 SharedData* get_data_ptr();
+SharedData* get_data_ptr_read_only();
+BOOL attach_inherited_data(int argc, char* argv[]);
 void initData();
+BOOL read_config_file(RuntimeConfig* cfg);
+void load_config_file();
+BOOL refresh_config();
+void initConfigWatch();
+void handle_config_events();
 void initSync();
+void refresh_lock_pid();
 void lockData();
 void unlockData();
 void cleanupDataSync();
@@ -119,17 +803,139 @@ void close_process_handle(app_info* app_info);
 BOOL process_is_completed(app_info* app_info);
 BOOL process_is_alive(long pid);
 void await_app(app_info* app_info);
-void launch_daughter_thread(void* (*func)(void*));
+void initChildEvents();
+BOOL wait_child_events(app_info** apps, int count, unsigned long timeout_ms);
+void await_apps(app_info** apps, int count);
+BOOL launch_daughter_thread(void* (*func)(void*), void* arg);
+app_info* launch_copy_thread(int role);
+void* copy_thread_func(void* arg);
+app_info* launch_copy(int role);
+void wake_main_loop();
+void notify_change();
+
+void initEventLoop();
+void loop_watch_fd(int fd);
+void timer_init(loop_timer* t);
+void timer_arm(loop_timer* t, double deadline);
+BOOL timer_due(loop_timer* t, double now);
+void timer_close(loop_timer* t);
+void wait_loop_events(app_info** apps, int count, double deadline);
+void request_shutdown();
+BOOL wait_shutdown(unsigned long ms);
+void initShutdownSignal();
+void stop_app(app_info* app_info);
+void cleanupEventLoop();
+
+void put_u64(unsigned char* buf, uint64_t value);
+uint64_t get_u64(unsigned char* buf);
+BOOL control_start();
+void control_stop();
+void control_accept();
+void control_close_client(control_client* c);
+void control_update_events(control_client* c);
+void control_flush(control_client* c);
+void control_process(control_client* c);
+void control_handle_event(uint32_t index, uint32_t events);
+void control_notify_watchers();
+void control_watch_start();
+void* control_watch_func(void* arg);
+
+BOOL metrics_start();
+void metrics_stop();
+void metrics_accept();
+void metrics_close_client(metrics_client* c);
+void metrics_flush(metrics_client* c);
+void metrics_handle_event(uint32_t index, uint32_t events);
+void metrics_refresh(double now);
+void metrics_append(char* buf, size_t size, size_t* len, const char* fmt, ...);
+size_t metrics_render(metrics_snapshot* m, double now, char* buf, size_t size);
+void metrics_task(wheel_timer* t, void* arg);
+
+void wheel_init(timer_wheel* w, double now);
+void wheel_timer_init(wheel_timer* t, wheel_callback func, void* arg);
+void wheel_link(timer_wheel* w, wheel_timer* t);
+void wheel_unlink(timer_wheel* w, wheel_timer* t);
+void wheel_add(timer_wheel* w, wheel_timer* t, double deadline, double period);
+void wheel_cancel(timer_wheel* w, wheel_timer* t);
+int wheel_advance(timer_wheel* w, double now);
+double wheel_next_expiry(timer_wheel* w);
+unsigned long long wheel_expected_runs(timer_wheel* w, wheel_timer* t);
+
+void histogram_record(lateness_histogram* h, double value);
+double histogram_percentile(lateness_histogram* h, double p);
+
+CounterStats* initStats(BOOL read_only);
+CounterStats* attach_inherited_stats(int argc, char* argv[]);
+void cleanupStats();
+int stat_bucket(uint64_t ns);
+uint64_t stat_bucket_upper(int bucket);
+void stat_record(stat_id id, uint64_t ns);
+void stat_count(event_id id, uint64_t n);
+void stat_snapshot_take(stat_histogram* h, stat_snapshot* snap);
+void stat_snapshot_diff(stat_snapshot* now, stat_snapshot* before, stat_snapshot* diff);
+uint64_t stat_percentile(stat_snapshot* snap, double p);
+char* stat_name(stat_id id);
+void trace_init(char* role);
+uint32_t trace_tid();
+void trace_span(trace_kind kind, uint64_t start_ns, uint64_t end_ns, uint64_t value);
+void trace_flush();
+char* trace_kind_name(trace_kind kind);
+void log_task_stats(timer_wheel* w, wheel_timer* t, char* name);
+
+void scheduler_init(copy_scheduler* s, int role, int max_in_flight, int max_queued);
+BOOL scheduler_has_slot(copy_scheduler* s);
+void scheduler_launch(copy_scheduler* s, double enqueue_time, double now);
+BOOL scheduler_submit(copy_scheduler* s, double now);
+void scheduler_poll(copy_scheduler* s, double now);
+void scheduler_cancel(copy_scheduler* s);
+void scheduler_count(copy_scheduler* s, event_id copy1_event, uint64_t n);
+int scheduler_apps(copy_scheduler* s, app_info** apps, int max);
+void scheduler_drain(copy_scheduler* s);
+void log_scheduler_stats(copy_scheduler* s, double now);
+
+void pacer_init(launch_pacer* p, BOOL adaptive, double min_interval, double max_interval, double now);
+BOOL pacer_should_launch(launch_pacer* p, double now, BOOL idle);
+double pacer_next_launch(launch_pacer* p, BOOL idle);
+void pacer_on_launch(launch_pacer* p, double now, BOOL idle);
+void pacer_on_idle(launch_pacer* p, double now);
+void log_pacer_stats(launch_pacer* p);
+
+BOOL copies_idle(counter_loop* loop);
+void increment_task(wheel_timer* t, void* arg);
+void log_task(wheel_timer* t, void* arg);
+void launch_task(wheel_timer* t, void* arg);
+void* hf_increment_func(void* arg);
+void loop_init(counter_loop* loop, double now);
+void loop_elect(counter_loop* loop);
+void loop_run_due(counter_loop* loop, double now);
 
 void main_counter_function();
+size_t read_input(FILE* f, char* buf, size_t size);
+BOOL terminal_command(char* line);
 void* terminal_func(void* arg);
+BOOL batch_parse_line(char* line, char* end, batch_result* r);
+void batch_parse_chunk(char* buf, size_t len, batch_result* r);
+void batch_apply(batch_result* r);
+void* batch_func(void* arg);
 void copy1_function();
+int copy2_begin();
+void copy2_end(BOOL interrupted);
 void copy2_function();
 
+#ifdef COUNTER_SIM
+void sim_sleep_ms(unsigned long ms);
+sim_process* sim_find(long pid);
+sim_process* sim_spawn(long parent, int role, uint64_t wake_ns);
+void sim_exit(long pid);
+app_info* launch_sim_copy(int role);
+#endif
+
 
 
 double get_curr_time() {
-#ifdef _WIN32
+#if defined(COUNTER_SIM)
+    return sim_now_ns / 1e6;
+#elif defined(_WIN32)
     LARGE_INTEGER freq, now;
     QueryPerformanceFrequency(&freq);
     QueryPerformanceCounter(&now);
@@ -141,6 +947,143 @@ double get_curr_time() {
 #endif
 }
 
+uint64_t get_curr_time_ns() {
+    // То же, что get_curr_time, но целыми наносекундами
+#if defined(COUNTER_SIM)
+    return sim_now_ns;
+#elif defined(_WIN32)
+    LARGE_INTEGER freq, now;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return (uint64_t) (now.QuadPart / freq.QuadPart) * 1000000000ULL +
+        (uint64_t) (now.QuadPart % freq.QuadPart) * 1000000000ULL / freq.QuadPart;
+#else // POSIX
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000ULL + now.tv_nsec;
+#endif
+}
+
+uint64_t read_tsc() {
+#ifdef HAVE_TSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+BOOL tsc_is_reliable() {
+    // TSC годится в часы, только если он инвариантный (идет с 
+    // постоянной частотой во всех состояниях процессора)
+#ifdef HAVE_TSC
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) || eax < 0x80000007)
+        return FALSE;
+    __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+    if (!(edx & (1u << 8)))
+        return FALSE;
+#ifndef _WIN32
+    // Ядро само проверяет TSC (синхронность между ядрами и т. п.) 
+    // и не выбирает его источником времени, если он ненадежен
+    FILE* f = fopen("/sys/devices/system/clocksource/clocksource0/current_clocksource", "r");
+    if (f) {
+        char name[32] = "";
+        BOOL is_tsc = fscanf(f, "%31s", name) == 1 && strcmp(name, "tsc") == 0;
+        fclose(f);
+        if (!is_tsc)
+            return FALSE;
+    }
+#endif
+    return TRUE;
+#else
+    return FALSE;
+#endif
+}
+
+void read_clock_pair(uint64_t* tsc, uint64_t* ns) {
+    // Показания TSC и CLOCK_MONOTONIC в один момент: из нескольких 
+    // попыток берем ту, где чтение часов заняло меньше всего тактов 
+    // (между ними не вклинились прерывание или вытеснение)
+    uint64_t best = UINT64_MAX;
+    for (int i = 0; i < 16; i++) {
+        uint64_t before = read_tsc();
+        uint64_t now = get_curr_time_ns();
+        uint64_t after = read_tsc();
+        if (after - before < best) {
+            best = after - before;
+            *tsc = before + (after - before) / 2;
+            *ns = now;
+        }
+    }
+}
+
+void initFastClock() {
+    // Вызывается после initStats: пригодность TSC проверяет и частоту 
+    // измеряет первый процесс, остальные (в том числе копии) берут 
+    // результат из /CounterStats и не тратят на запуск ни cpuid, 
+    // ни чтение sysfs, ни FAST_CLOCK_CALIBRATION
+    fast_clock.use_tsc = FALSE;
+    char* forced = getenv(FAST_CLOCK_ENV);
+    if (forced && strcmp(forced, "monotonic") == 0)
+        return;
+
+    uint64_t ticks = stats ? atomic_load_explicit(&stats->tsc_ticks, memory_order_acquire) : 0;
+    uint64_t ns = stats ? atomic_load(&stats->tsc_ns) : 0;
+    if (ticks == FAST_CLOCK_NO_TSC)
+        return;
+    if (ticks == 0 || ns == 0) {
+        if (!tsc_is_reliable()) {
+            if (stats)
+                atomic_store_explicit(&stats->tsc_ticks, FAST_CLOCK_NO_TSC, memory_order_release);
+            return;
+        }
+        uint64_t tsc_start = 0, ns_start = 0, tsc_end = 0, ns_end = 0;
+        read_clock_pair(&tsc_start, &ns_start);
+        sleep_ms(FAST_CLOCK_CALIBRATION);
+        read_clock_pair(&tsc_end, &ns_end);
+        ticks = tsc_end - tsc_start;
+        ns = ns_end - ns_start;
+        if (stats) {
+            atomic_store(&stats->tsc_ns, ns);
+            atomic_store_explicit(&stats->tsc_ticks, ticks, memory_order_release);
+        }
+    }
+
+    // Частота вне 100 МГц..10 ГГц — калибровка не удалась
+    double ns_per_tick = (double) ns / (double) ticks;
+    if (ticks == 0 || ns_per_tick < 0.1 || ns_per_tick > 10.0)
+        return;
+
+    fast_clock.ns_per_tick = ns_per_tick;
+    read_clock_pair(&fast_clock.tsc_base, &fast_clock.ns_base);
+    fast_clock.use_tsc = TRUE;
+}
+
+uint64_t get_fast_time_ns() {
+    // Для длительностей (гистограммы, замеры). Сроки и метки времени, 
+    // общие с другими процессами, по-прежнему берутся из 
+    // get_curr_time_ns: ошибка калибровки копится со временем
+    if (fast_clock.use_tsc)
+        return fast_clock.ns_base + 
+            (uint64_t) ((double) (read_tsc() - fast_clock.tsc_base) * fast_clock.ns_per_tick);
+    return get_curr_time_ns();
+}
+
+void sleep_until_ns(uint64_t deadline) {
+    // Сон до абсолютного момента (get_curr_time_ns): в отличие от 
+    // сна на интервал, задержки пробуждения не накапливаются
+#ifdef _WIN32
+    uint64_t now = get_curr_time_ns();
+    if (deadline > now)
+        Sleep((DWORD) ((deadline - now) / 1000000));
+#else // POSIX
+    struct timespec ts;
+    ts.tv_sec = deadline / 1000000000ULL;
+    ts.tv_nsec = deadline % 1000000000ULL;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {}
+#endif
+}
+
 char* get_time_str() {
     time_t now;
     struct tm tm_info;
@@ -149,7 +1092,11 @@ char* get_time_str() {
     time(&now);
 
     // Потокобезопасное получение структуры даты и времени
-#ifdef _WIN32
+#if defined(COUNTER_SIM)
+    // Виртуальное время в UTC: лог не зависит от часового пояса
+    now = (time_t) (SIM_EPOCH + sim_now_ns / 1000000000ULL);
+    gmtime_r(&now, &tm_info);
+#elif defined(_WIN32)
     localtime_s(&tm_info, &now);
 #else // POSIX
     localtime_r(&now, &tm_info);
@@ -161,7 +1108,9 @@ char* get_time_str() {
 }
 
 void log_msg(char* msg) {
-    FILE* f = fopen(LOG_FILE, "a");
+    uint64_t start = get_fast_time_ns();
+    char log_name[NAME_SIZE];
+    FILE* f = fopen(shared_name(LOG_FILE, log_name, sizeof(log_name)), "a");
     if (!f) {
         perror("Couldn't open the file!");
         return;
@@ -196,7 +1145,7 @@ void log_msg(char* msg) {
 #endif
 
     char* time_str = get_time_str();
-    fprintf(f, "[%s] (PID: %lu)\tMSG: %s\n", time_str, (unsigned long) get_current_pid(), msg);
+    int written = fprintf(f, "[%s] (PID: %lu)\tMSG: %s\n", time_str, (unsigned long) get_current_pid(), msg);
     free(time_str);
 
 #ifdef _WIN32
@@ -207,6 +1156,15 @@ void log_msg(char* msg) {
 #endif
 
     fclose(f);
+    uint64_t duration = get_fast_time_ns() - start;
+    stat_record(STAT_LOG_WRITE, duration);
+    if (trace_enabled) {
+        uint64_t end = get_curr_time_ns();
+        trace_span(TRACE_LOG_WRITE, end - duration, end, 0);
+    }
+    COUNTER_PROBE2(log_write, msg, duration);
+    if (written > 0)
+        stat_count(EVENT_LOG_BYTES, (uint64_t) written);
 }
 
 void log_counter_val() {
@@ -240,19 +1198,158 @@ char* trimspaces(char *str) {
     return str;
 }
 
+BOOL parse_int_option(char* name, char* str, long min, long max, int* value) {
+    // Целое значение опции: все число целиком и в пределах [min, max] 
+    // (atoi молча превращал "abc" в 0, а "10x" — в 10)
+    char* end;
+    errno = 0;
+    long parsed = strtol(str, &end, 10);
+    if (end == str || *end != '\0' || errno == ERANGE || parsed < min || parsed > max) {
+        printf("Invalid value for %s: %s (expected %ld..%ld)\n", name, str, min, max);
+        return FALSE;
+    }
+    *value = (int) parsed;
+    return TRUE;
+}
+
+BOOL parse_options(int argc, char* argv[]) {
+    // Разбор аргументов командной строки:
+    //   --copies N   сколько копий каждой роли может работать одновременно
+    //   --queue M    сколько запусков каждой роли может ждать в очереди
+    //   --exec process|thread     как запускать копии
+    //   --catch-up skip|burst|coalesce   как догонять пропущенные инкременты
+    //   --hf-rate N               инкрементов в секунду в отдельном потоке
+    //   --hf-pacing sleep|spin    как этот поток ждет следующего инкремента
+    //   --pacing fixed|adaptive   темп запуска копий
+    //   --min-interval MS         нижняя граница адаптивного темпа
+    //   --max-interval MS         верхняя граница адаптивного темпа
+    //   --batch FILE|-            выполнить команды set/add из файла или stdin
+    //   --metrics-port PORT       отдавать метрики Prometheus на 127.0.0.1:PORT
+
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 < argc && strcmp(argv[i], "--copies") == 0) {
+            if (!parse_int_option(argv[i], argv[i + 1], 1, MAX_COPY_JOBS, &options.copy_concurrency))
+                return FALSE;
+            i++;
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "--queue") == 0) {
+            if (!parse_int_option(argv[i], argv[i + 1], 0, MAX_COPY_QUEUE, &options.copy_queue_limit))
+                return FALSE;
+            i++;
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "--exec") == 0) {
+            i++;
+            if (strcmp(argv[i], "thread") == 0) {
+                options.thread_copies = TRUE;
+            } else if (strcmp(argv[i], "process") == 0) {
+                options.thread_copies = FALSE;
+            } else {
+                printf("Unknown exec mode: %s\n", argv[i]);
+                return FALSE;
+            }
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "--catch-up") == 0) {
+            i++;
+            if (strcmp(argv[i], "skip") == 0) {
+                options.increment_catch_up = CATCH_UP_SKIP;
+            } else if (strcmp(argv[i], "burst") == 0) {
+                options.increment_catch_up = CATCH_UP_BURST;
+            } else if (strcmp(argv[i], "coalesce") == 0) {
+                options.increment_catch_up = CATCH_UP_COALESCE;
+            } else {
+                printf("Unknown catch-up policy: %s\n", argv[i]);
+                return FALSE;
+            }
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "--hf-rate") == 0) {
+            char* end;
+            i++;
+            options.hf_rate = strtod(argv[i], &end);
+            if (end == argv[i] || *end != '\0' || !(options.hf_rate >= 0 && options.hf_rate <= HF_MAX_RATE)) {
+                printf("Invalid value for --hf-rate: %s (expected 0..%d)\n", argv[i], HF_MAX_RATE);
+                return FALSE;
+            }
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "--hf-pacing") == 0) {
+            i++;
+            if (strcmp(argv[i], "spin") == 0) {
+                options.hf_spin = TRUE;
+            } else if (strcmp(argv[i], "sleep") == 0) {
+                options.hf_spin = FALSE;
+            } else {
+                printf("Unknown high-frequency pacing: %s\n", argv[i]);
+                return FALSE;
+            }
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "--pacing") == 0) {
+            i++;
+            if (strcmp(argv[i], "adaptive") == 0) {
+                options.adaptive_pacing = TRUE;
+            } else if (strcmp(argv[i], "fixed") == 0) {
+                options.adaptive_pacing = FALSE;
+            } else {
+                printf("Unknown pacing mode: %s\n", argv[i]);
+                return FALSE;
+            }
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "--min-interval") == 0) {
+            if (!parse_int_option(argv[i], argv[i + 1], 0, INT_MAX, &options.min_launch_interval))
+                return FALSE;
+            i++;
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "--max-interval") == 0) {
+            if (!parse_int_option(argv[i], argv[i + 1], 0, INT_MAX, &options.max_launch_interval))
+                return FALSE;
+            i++;
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "--batch") == 0) {
+            options.batch_path = argv[++i];
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "--metrics-port") == 0) {
+            if (!parse_int_option(argv[i], argv[i + 1], 0, 65535, &options.metrics_port))
+                return FALSE;
+            i++;
+        }
+        else {
+            printf("Unknown option: %s\n", argv[i]);
+            return FALSE;
+        }
+    }
+
+    if (options.copy_concurrency < 1 || options.copy_concurrency > MAX_COPY_JOBS ||
+        options.copy_queue_limit < 0 || options.copy_queue_limit > MAX_COPY_QUEUE ||
+        options.hf_rate < 0 ||
+        options.min_launch_interval < 0 ||
+        options.max_launch_interval < options.min_launch_interval ||
+        options.metrics_port < 0 || options.metrics_port > 65535) {
+        printf("Invalid option value.\n");
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
 
 
 SharedData* get_data_ptr() {
-#ifdef _WIN32
+#if defined(COUNTER_SIM)
+
+    // Все виртуальные процессы живут в одном настоящем, 
+    // поэтому разделяемая память им не нужна
+    data = (SharedData*) calloc(1, sizeof(SharedData));
+    return data;
+
+#elif defined(_WIN32)
 
     // Создает или открывает (если уже есть) общий объект для всех процессов
+    char name[NAME_SIZE];
     SharedData_hMap = CreateFileMapping(
         INVALID_HANDLE_VALUE,   // не привязан к файлу на диске
         NULL,                   // атрибуты безопасности (по умолчанию)
         PAGE_READWRITE,         // права
         0,                      // старшие 32 бита размера, честно, без понятия, так было в документации
         sizeof(SharedData),  // младшие 32 бита размера
-        "SharedData"         // имя объекта разделяемой памяти
+        shared_name("SharedData", name, sizeof(name))   // имя объекта разделяемой памяти
     );
 
     if (!SharedData_hMap) {
@@ -273,7 +1370,8 @@ SharedData* get_data_ptr() {
 #else // POSIX
     
     // Создаём или открываем объект разделяемой памяти
-    shm_fd = shm_open("/SharedData", O_CREAT | O_RDWR, 0666);
+    char name[NAME_SIZE];
+    shm_fd = shm_open(shared_name("/SharedData", name, sizeof(name)), O_CREAT | O_RDWR, 0666);
     if (shm_fd == -1) {
         perror("shm_open failed");
         return NULL;
@@ -299,77 +1397,383 @@ SharedData* get_data_ptr() {
 #endif
 }
 
-void initData() {
-    lockData();
-    data->counter = 0;
-    data->leader_pid = get_current_pid();
-    unlockData();
-}
+SharedData* get_data_ptr_read_only() {
+    // Только чтение и без создания (counter_top): наблюдатель 
+    // не может ни испортить счетчик, ни создать пустой сегмент. 
+    // NULL — ни один экземпляр еще не запускался
+#if defined(_WIN32)
 
-void initSync() {
-#ifdef _WIN32
+    char name[NAME_SIZE];
+    SharedData_hMap = OpenFileMapping(FILE_MAP_READ, FALSE, shared_name("SharedData", name, sizeof(name)));
+    if (!SharedData_hMap)
+        return NULL;
+    data = (SharedData*) MapViewOfFile(SharedData_hMap, FILE_MAP_READ, 0, 0, sizeof(SharedData));
+    return data;
 
-    // Мью́текс (англ. mutex, от mutual exclusion — «взаимное исключение») — 
-    // примитив синхронизации, обеспечивающий взаимное исключение исполнения 
-    // критических участков кода.
-    // Стандарт C не обязывает атомики работать межпроцессно.
+#else // POSIX
 
-    hDataMutex = CreateMutex(
-        NULL,           // атрибуты безопасности (по умолчанию)
-        FALSE,          // вызывающий поток не получает права владения мьютексом изначально
-        "DataMutex"     // имя объекта мьютекса
-    );
-    if (!hDataMutex) {
-        perror("CreateMutex failed");
-        return;
-    }
+    char name[NAME_SIZE];
+    shm_fd = shm_open(shared_name("/SharedData", name, sizeof(name)), O_RDONLY, 0);
+    if (shm_fd == -1)
+        return NULL;
 
-#else // POSIX
+    // Сегмент старой раскладки короче — читать его за концом нельзя
+    struct stat st;
+    if (fstat(shm_fd, &st) == -1 || st.st_size < (off_t) sizeof(SharedData)) {
+        close(shm_fd);
+        shm_fd = -1;
+        return NULL;
+    }
 
-    // Создаём или открываем именованный семафор
-    shm_sem = sem_open("/DataSem", O_CREAT, 0666, 1);
-    if (shm_sem == SEM_FAILED) {
-        perror("sem_open failed");
-        return;
+    data = (SharedData*) mmap(NULL, sizeof(SharedData), PROT_READ, MAP_SHARED, shm_fd, 0);
+    if (data == MAP_FAILED) {
+        perror("mmap failed");
+        data = NULL;
+        close(shm_fd);
+        shm_fd = -1;
     }
+    return data;
 
 #endif
 }
 
-void lockData() {
+BOOL attach_inherited_data(int argc, char* argv[]) {
+    // Подключение к разделяемой памяти по дескрипторам, унаследованным 
+    // от лидера (см. launch_daughter_process). Обходится без повторного 
+    // открытия объектов по имени и без ftruncate живого сегмента.
 #ifdef _WIN32
 
-    // ждем, пока мьютекс освободится
-    DWORD waitResult = WaitForSingleObject(hDataMutex, INFINITE);
-    if (waitResult != WAIT_OBJECT_0) {
-        // Ошибка ожидания
-        CloseHandle(hDataMutex);
-        return;
-    }
+    if (argc < 4)
+        return FALSE;
 
-#else // POSIX
+    SharedData_hMap = (HANDLE) (uintptr_t) strtoull(argv[2], NULL, 10);
+    hDataMutex = (HANDLE) (uintptr_t) strtoull(argv[3], NULL, 10);
 
-    // Ждём (захватываем)
-    if (sem_wait(shm_sem) == -1) {
-        perror("sem_wait failed");
-        return;
+    data = (SharedData*) MapViewOfFile(
+        SharedData_hMap,
+        FILE_MAP_ALL_ACCESS,
+        0, 0,
+        sizeof(SharedData)
+    );
+    if (!data) {
+        perror("MapViewOfFile failed");
+        SharedData_hMap = NULL;
+        hDataMutex = NULL;
+        return FALSE;
     }
 
-#endif
-}
+    return TRUE;
 
-void unlockData() {
-#ifdef _WIN32
-    ReleaseMutex(hDataMutex);   // отпускаем мьютекс
 #else // POSIX
-    if (sem_post(shm_sem) == -1) {
-        perror("sem_post failed");
+
+    if (argc < 3)
+        return FALSE;
+
+    shm_fd = atoi(argv[2]);
+
+    // Только отображаем уже открытый объект в память
+    data = (SharedData*) mmap(NULL, sizeof(SharedData), PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+    if (data == MAP_FAILED) {
+        perror("mmap failed");
+        data = NULL;
+        shm_fd = -1;
+        return FALSE;
+    }
+
+    // Мьютекс лежит в той же памяти, открывать больше нечего
+    initSync();
+
+    return TRUE;
+
+#endif
+}
+
+void initData() {
+    lockData();
+    data->counter = 0;
+    if (data->leader_pid != get_current_pid()) {
+        stat_count(EVENT_LEADER_CHANGES, 1);
+        COUNTER_PROBE2(leader_change, data->leader_pid, (long) get_current_pid());
+    }
+    data->leader_pid = get_current_pid();
+    atomic_store(&data->leader_since_ns, get_curr_time_ns());
+    // Счетчик ждущих мог остаться от убитых процессов (или от старой 
+    // раскладки SharedData) — тогда каждое изменение делало бы лишний 
+    // syscall. Если кто-то сейчас ждет, после сброса счетчик уйдет 
+    // в переполнение, и пробуждения просто будут всегда
+    atomic_store(&data->change_waiters, 0);
+    unlockData();
+    notify_change();
+
+    load_config_file();
+}
+
+BOOL read_config_file(RuntimeConfig* cfg) {
+    // Разбирает CONFIG_FILE вида "key = value" (строки с # — комментарии).
+    // Отсутствующие ключи получают значения по умолчанию.
+    RuntimeConfig result = {
+        MAIN_CYCLE_DELAY,
+        INCREMENT_DELAY,
+        LOG_COUNTER_DELAY,
+        LAUNCH_COPIES_DELAY,
+        COPY2_DELAY,
+    };
+
+    FILE* f = fopen(CONFIG_FILE, "r");
+    if (f) {
+        char line[128];
+        while (fgets(line, sizeof(line), f)) {
+            line[strcspn(line, "#\r\n")] = '\0';
+            char* trimmed = trimspaces(line);
+            if (trimmed[0] == '\0')
+                continue;
+
+            char* eq = strchr(trimmed, '=');
+            if (!eq) {
+                printf("Invalid config line: %s\n", trimmed);
+                continue;
+            }
+            *eq = '\0';
+            char* key = trimspaces(trimmed);
+            int value = atoi(eq + 1);
+            if (value <= 0) {
+                printf("Invalid config value for %s.\n", key);
+                continue;
+            }
+
+            if (strcmp(key, "main_cycle_delay") == 0) result.main_cycle_delay = value;
+            else if (strcmp(key, "increment_delay") == 0) result.increment_delay = value;
+            else if (strcmp(key, "log_counter_delay") == 0) result.log_counter_delay = value;
+            else if (strcmp(key, "launch_copies_delay") == 0) result.launch_copies_delay = value;
+            else if (strcmp(key, "copy2_delay") == 0) result.copy2_delay = value;
+            else printf("Unknown config key: %s\n", key);
+        }
+        fclose(f);
+    }
+
+    *cfg = result;
+    return f != NULL;
+}
+
+void load_config_file() {
+    // Читает CONFIG_FILE и публикует настройки для всех экземпляров
+    RuntimeConfig cfg;
+    read_config_file(&cfg);
+
+    lockData();
+    if (atomic_load(&data->config_version) == 0 ||
+        memcmp(&data->config, &cfg, sizeof(cfg)) != 0) {
+        data->config = cfg;
+        atomic_fetch_add(&data->config_version, 1);
+    }
+    unlockData();
+}
+
+BOOL refresh_config() {
+    // Одна проверка номера версии; TRUE, если настройки поменялись
+    unsigned int version = atomic_load(&data->config_version);
+    if (version == config_version)
+        return FALSE;
+
+    lockData();
+    config = data->config;
+    config_version = atomic_load(&data->config_version);
+    unlockData();
+    return TRUE;
+}
+
+void initConfigWatch() {
+    // Следим и за файлом (запись), и за папкой (появление файла): 
+    // редакторы часто сохраняют файл через переименование, и слежка 
+    // за старым файлом теряется. Запись в папку (например, в лог) 
+    // цикл не будит.
+#ifndef _WIN32
+    config_watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (config_watch_fd == -1) {
+        perror("inotify_init1 failed");
+        return;
+    }
+    config_file_wd = inotify_add_watch(config_watch_fd, CONFIG_FILE, IN_CLOSE_WRITE);
+    if (inotify_add_watch(config_watch_fd, ".", IN_CREATE | IN_MOVED_TO | IN_DELETE) == -1) {
+        perror("inotify_add_watch failed");
+        close(config_watch_fd);
+        config_watch_fd = -1;
+        return;
+    }
+    loop_watch_fd(config_watch_fd);
+#endif
+}
+
+void handle_config_events() {
+    // Вычитывает события inotify и отмечает, если менялся CONFIG_FILE
+#ifndef _WIN32
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t len;
+    while ((len = read(config_watch_fd, buffer, sizeof(buffer))) > 0) {
+        for (char* ptr = buffer; ptr < buffer + len; ) {
+            struct inotify_event* ev = (struct inotify_event*) ptr;
+            if (ev->len > 0 && strcmp(ev->name, CONFIG_FILE) == 0) {
+                // Файл появился заново — следим уже за новым
+                config_file_changed = TRUE;
+                config_file_wd = inotify_add_watch(config_watch_fd, CONFIG_FILE, IN_CLOSE_WRITE);
+            }
+            else if (ev->wd == config_file_wd && (ev->mask & IN_CLOSE_WRITE)) {
+                config_file_changed = TRUE;
+            }
+            ptr += sizeof(struct inotify_event) + ev->len;
+        }
+    }
+#endif
+}
+
+void initSync() {
+#if defined(COUNTER_SIM)
+
+    // Виртуальные процессы выполняются по очереди, 
+    // блокировать нечего
+
+#elif defined(_WIN32)
+
+    // Мью́текс (англ. mutex, от mutual exclusion — «взаимное исключение») — 
+    // примитив синхронизации, обеспечивающий взаимное исключение исполнения 
+    // критических участков кода.
+    // Стандарт C не обязывает атомики работать межпроцессно.
+
+    char name[NAME_SIZE];
+    hDataMutex = CreateMutex(
+        NULL,           // атрибуты безопасности (по умолчанию)
+        FALSE,          // вызывающий поток не получает права владения мьютексом изначально
+        shared_name("DataMutex", name, sizeof(name))    // имя объекта мьютекса
+    );
+    if (!hDataMutex) {
+        perror("CreateMutex failed");
+        return;
+    }
+
+#else // POSIX
+
+    // Мьютекс в /SharedData: создаем, если его еще нет
+    if (!data || !shared_lock_ready(data, TRUE)) {
+        fprintf(stderr, "Shared lock is not initialized.\n");
+        return;
+    }
+
+    // После fork без exec (counter_bench) у потомка свой pid
+    if (lock_pid == 0)
+        pthread_atfork(NULL, NULL, refresh_lock_pid);
+    refresh_lock_pid();
+
+#endif
+}
+
+void refresh_lock_pid() {
+#ifndef _WIN32
+    lock_pid = (long) getpid();
+#endif
+}
+
+void lockData() {
+#if defined(COUNTER_SIM)
+
+    // См. initSync
+    return;
+
+#elif defined(_WIN32)
+
+    // Свободный мьютекс берем без замера времени
+    if (WaitForSingleObject(hDataMutex, 0) == WAIT_OBJECT_0) {
+        stat_record(STAT_LOCK_WAIT, 0);
+        COUNTER_PROBE1(lock_acquire, 0);
+        if (trace_enabled)
+            trace_lock_acquired = get_curr_time_ns();
+        return;
+    }
+
+    // ждем, пока мьютекс освободится
+    uint64_t start = get_fast_time_ns();
+    DWORD waitResult = WaitForSingleObject(hDataMutex, INFINITE);
+    if (waitResult == WAIT_ABANDONED) {
+        // Владелец умер, не отпустив мьютекс: Windows отдает его нам
+        stat_count(EVENT_LOCK_RECOVERIES, 1);
+    }
+    else if (waitResult != WAIT_OBJECT_0) {
+        // Ошибка ожидания
+        CloseHandle(hDataMutex);
+        return;
+    }
+
+    uint64_t wait = get_fast_time_ns() - start;
+    stat_record(STAT_LOCK_WAIT, wait);
+    COUNTER_PROBE1(lock_acquire, wait);
+    if (trace_enabled) {
+        trace_lock_acquired = get_curr_time_ns();
+        trace_span(TRACE_LOCK_WAIT, trace_lock_acquired - wait, trace_lock_acquired, 0);
+    }
+
+#else // POSIX
+
+    // Свободный мьютекс берем без замера времени
+    long recovered_from = 0;
+    uint64_t start = 0;
+    int rc = shared_lock_acquire(data, TRUE, &recovered_from);
+    if (rc == EBUSY) {
+        // Ждём (захватываем)
+        start = get_fast_time_ns();
+        rc = shared_lock_acquire(data, FALSE, &recovered_from);
+    }
+    if (rc != 0) {
+        errno = rc;
+        perror("pthread_mutex_lock failed");
+        return;
+    }
+    atomic_store_explicit(&data->lock_owner, lock_pid, memory_order_relaxed);
+    if (recovered_from) {
+        stat_count(EVENT_LOCK_RECOVERIES, 1);
+        char msg[80];
+        snprintf(msg, sizeof(msg), "Lock recovered from dead process %ld.", recovered_from);
+        log_msg(msg);
+    }
+    if (start == 0) {
+        stat_record(STAT_LOCK_WAIT, 0);
+        COUNTER_PROBE1(lock_acquire, 0);
+        if (trace_enabled)
+            trace_lock_acquired = get_curr_time_ns();
+        return;
+    }
+    uint64_t wait = get_fast_time_ns() - start;
+    stat_record(STAT_LOCK_WAIT, wait);
+    COUNTER_PROBE1(lock_acquire, wait);
+    if (trace_enabled) {
+        trace_lock_acquired = get_curr_time_ns();
+        trace_span(TRACE_LOCK_WAIT, trace_lock_acquired - wait, trace_lock_acquired, 0);
+    }
+
+#endif
+}
+
+void unlockData() {
+    COUNTER_PROBE(lock_release);
+    if (trace_enabled)
+        trace_span(TRACE_LOCK_HELD, trace_lock_acquired, get_curr_time_ns(), 0);
+#if defined(COUNTER_SIM)
+    return;
+#elif defined(_WIN32)
+    ReleaseMutex(hDataMutex);   // отпускаем мьютекс
+#else // POSIX
+    atomic_store_explicit(&data->lock_owner, 0, memory_order_relaxed);
+    int rc = pthread_mutex_unlock(&data->lock);
+    if (rc != 0) {
+        errno = rc;
+        perror("pthread_mutex_unlock failed");
     }
 #endif
 }
 
 void cleanupDataSync() {
-#ifdef _WIN32
+#if defined(COUNTER_SIM)
+    free(data);
+    data = NULL;
+#elif defined(_WIN32)
     if (hDataMutex) {
         CloseHandle(hDataMutex);
         hDataMutex = NULL;
@@ -383,10 +1787,6 @@ void cleanupDataSync() {
         SharedData_hMap = NULL;
     }
 #else
-    if (shm_sem != SEM_FAILED) {
-        sem_close(shm_sem);     // закрываем дескриптор семафора
-        shm_sem = SEM_FAILED;
-    }
     if (data && data != MAP_FAILED) {
         munmap(data, sizeof(SharedData));   // отключаем память
         data = NULL;
@@ -409,7 +1809,21 @@ app_info* launch_daughter_process(int argc) {
     si.cb = sizeof(si);
 
     char buffer[100];
-    snprintf(buffer, sizeof(buffer), "counter_daughter.exe %d", argc);
+    if (inherit_handles && SharedData_hMap && hDataMutex) {
+        // Разрешаем наследование и передаем значения хэндлов в командной строке
+        SetHandleInformation(SharedData_hMap, HANDLE_FLAG_INHERIT, HANDLE_FLAG_INHERIT);
+        SetHandleInformation(hDataMutex, HANDLE_FLAG_INHERIT, HANDLE_FLAG_INHERIT);
+        int len = snprintf(buffer, sizeof(buffer), "counter_daughter.exe %d %llu %llu", argc,
+            (unsigned long long) (uintptr_t) SharedData_hMap,
+            (unsigned long long) (uintptr_t) hDataMutex);
+        if (Stats_hMap) {
+            SetHandleInformation(Stats_hMap, HANDLE_FLAG_INHERIT, HANDLE_FLAG_INHERIT);
+            snprintf(buffer + len, sizeof(buffer) - len, " %llu",
+                (unsigned long long) (uintptr_t) Stats_hMap);
+        }
+    } else {
+        snprintf(buffer, sizeof(buffer), "counter_daughter.exe %d", argc);
+    }
 
     // Запускаем программу
     WINBOOL success = CreateProcessA(
@@ -435,7 +1849,9 @@ app_info* launch_daughter_process(int argc) {
 
     // Возвращаем указатель на процесс
     app_info* info = (app_info*) malloc(sizeof(app_info));
+    memset(info, 0, sizeof(*info));
     info->hProcess = pi.hProcess;
+    info->role = argc;
     return info;
 
 #else // POSIX
@@ -445,9 +1861,38 @@ app_info* launch_daughter_process(int argc) {
 
     if (pid == 0) {
         // Дочерний процесс
+
+        // Маска сигналов переживает execv, а лидер блокирует SIGCHLD 
+        // ради signalfd (см. initChildEvents) — возвращаем как было
+        sigset_t mask;
+        sigemptyset(&mask);
+        sigaddset(&mask, SIGCHLD);
+        pthread_sigmask(SIG_UNBLOCK, &mask, NULL);
+        // SIGTERM, наоборот, блокируем сразу: копия читает его через 
+        // signalfd (см. initShutdownSignal) и не должна умереть от 
+        // него, держа блокировку данных
+        sigemptyset(&mask);
+        sigaddset(&mask, SIGTERM);
+        pthread_sigmask(SIG_BLOCK, &mask, NULL);
         char arg_str[16];
+        char fd_str[16];
+        char stats_fd_str[16];
         snprintf(arg_str, sizeof(arg_str), "%d", argc);
-        char* const argv[] = {"./counter_daughter", arg_str, NULL};
+        char* argv[] = {"./counter_daughter", arg_str, NULL, NULL, NULL};
+
+        if (inherit_handles && shm_fd >= 0) {
+            // shm_open выставляет FD_CLOEXEC, снимаем его, 
+            // чтобы дескриптор пережил execv
+            fcntl(shm_fd, F_SETFD, 0);
+            snprintf(fd_str, sizeof(fd_str), "%d", shm_fd);
+            argv[2] = fd_str;
+            if (stats_fd >= 0) {
+                fcntl(stats_fd, F_SETFD, 0);
+                snprintf(stats_fd_str, sizeof(stats_fd_str), "%d", stats_fd);
+                argv[3] = stats_fd_str;
+            }
+        }
+
         execv("./counter_daughter", argv);
 
         // Если execv успешен — дочерний 
@@ -458,7 +1903,9 @@ app_info* launch_daughter_process(int argc) {
     } else if (pid > 0) {
         // Родительский процесс
         app_info* info = (app_info*) malloc(sizeof(app_info));
+        memset(info, 0, sizeof(*info));
         info->pid = pid;
+        info->role = argc;
         return info;
     } else {
         // fork не сработал
@@ -469,18 +1916,33 @@ app_info* launch_daughter_process(int argc) {
 }
 
 void close_process_handle(app_info* app_info) {
+    if (!app_info)
+        return;
 #ifdef _WIN32
-    CloseHandle(app_info->hProcess);
+    if (!app_info->is_thread)
+        CloseHandle(app_info->hProcess);
     // Выполнение подпроцесса не останавливается после закрытия хэндла
 #endif
     free(app_info);
 }
 
 BOOL process_is_completed(app_info* app_info) {
-#ifdef _WIN32
+    if (!app_info || app_info->completed)
+        return TRUE;
+
+    if (app_info->is_thread) {
+        app_info->completed = atomic_load(&app_info->thread_done);
+        return app_info->completed;
+    }
+
+#if defined(COUNTER_SIM)
+
+    app_info->completed = (sim_find(app_info->pid) == NULL);
+
+#elif defined(_WIN32)
 
     DWORD exitCode;
-    return (GetExitCodeProcess(app_info->hProcess, &exitCode) && 
+    app_info->completed = (GetExitCodeProcess(app_info->hProcess, &exitCode) && 
         exitCode != STILL_ACTIVE);
 
 #else // POSIX
@@ -489,18 +1951,20 @@ BOOL process_is_completed(app_info* app_info) {
     pid_t result = waitpid(app_info->pid, &status, WNOHANG);
     if (result == 0) {
         return FALSE;
-    } else if (result == app_info->pid) {
-        return TRUE;
-    } else {
-        // ошибка
-        return -1;
     }
+    // result == pid — процесс собран; -1 — ошибка (например, его 
+    // уже кто-то собрал), ждать его все равно больше нечего
+    app_info->completed = TRUE;
 
 #endif
+
+    return app_info->completed;
 }
 
 BOOL process_is_alive(long pid) {
-#ifdef _WIN32
+#if defined(COUNTER_SIM)
+    return sim_find(pid) != NULL;
+#elif defined(_WIN32)
     HANDLE h = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, (DWORD) pid);
     if (h == NULL) return FALSE;
 
@@ -528,6 +1992,12 @@ BOOL process_is_alive(long pid) {
 }
 
 void await_app(app_info* app_info) {
+    if (!app_info || app_info->completed)
+        return;
+    if (app_info->is_thread) {
+        await_apps(&app_info, 1);
+        return;
+    }
 #ifdef _WIN32
     const unsigned long awaitTime = INFINITE;
     WaitForSingleObject(app_info->hProcess, awaitTime);
@@ -535,222 +2005,2559 @@ void await_app(app_info* app_info) {
     int status;
     pid_t result = waitpid(app_info->pid, &status, 0);
 #endif
+    app_info->completed = TRUE;
+}
+
+void initChildEvents() {
+    // Завершение дочерних процессов приходит событием, а не 
+    // обнаруживается опросом. Вызывать до создания других потоков, 
+    // чтобы маска сигналов досталась им по наследству.
+#ifndef _WIN32
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+    child_events_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (child_events_fd == -1) {
+        perror("signalfd failed");
+    }
+
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake_fd == -1) {
+        perror("eventfd failed");
+    }
+#endif
+}
+
+BOOL wait_child_events(app_info** apps, int count, unsigned long timeout_ms) {
+    // Ждет завершения любого из дочерних процессов не дольше timeout_ms.
+    // Возвращает TRUE, если что-то завершилось (или могло завершиться).
+#ifdef _WIN32
+
+    // Копии-потоки проверяются по флагу, ждать получится только процессы
+    HANDLE handles[MAXIMUM_WAIT_OBJECTS];
+    DWORD n = 0;
+    for (int i = 0; i < count && n < MAXIMUM_WAIT_OBJECTS; i++) {
+        if (apps[i] && !apps[i]->completed && !apps[i]->is_thread)
+            handles[n++] = apps[i]->hProcess;
+    }
+
+    if (n == 0) {
+        Sleep(timeout_ms);
+        return FALSE;
+    }
+
+    DWORD result = WaitForMultipleObjects(n, handles, FALSE, timeout_ms);
+    return (result < WAIT_OBJECT_0 + n);
+
+#else // POSIX
+
+    // Процессы узнаются по SIGCHLD, сам список нужен только Windows
+    (void) apps;
+    (void) count;
+
+    if (child_events_fd == -1) {
+        // signalfd недоступен — старое поведение
+        sleep_ms(timeout_ms);
+        return TRUE;
+    }
+
+    struct pollfd pfds[2] = {
+        { .fd = child_events_fd, .events = POLLIN },
+        { .fd = wake_fd, .events = POLLIN },
+    };
+    int ready = poll(pfds, 2, (int) timeout_ms);
+    if (ready <= 0)
+        return FALSE;
+
+    // Вычитываем все накопившиеся SIGCHLD (они склеиваются, 
+    // поэтому проверять потом нужно все процессы)
+    struct signalfd_siginfo info;
+    while (read(child_events_fd, &info, sizeof(info)) == sizeof(info)) {}
+
+    uint64_t wakeups;
+    if (wake_fd != -1)
+        read(wake_fd, &wakeups, sizeof(wakeups));
+    return TRUE;
+
+#endif
+}
+
+void await_apps(app_info** apps, int count) {
+    // Ждет все процессы сразу, собирая каждый по мере завершения
+    for (;;) {
+        BOOL all_completed = TRUE;
+        for (int i = 0; i < count; i++) {
+            if (!process_is_completed(apps[i]))
+                all_completed = FALSE;
+        }
+        if (all_completed)
+            return;
+        wait_child_events(apps, count, LAUNCH_COPIES_DELAY);
+    }
 }
 
-void launch_daughter_thread(void* (*func)(void*)) {
+BOOL launch_daughter_thread(void* (*func)(void*), void* arg) {
 #ifdef _WIN32
-    HANDLE h = CreateThread(NULL, 0, func, NULL, 0, NULL);
+    HANDLE h = CreateThread(NULL, 0, func, arg, 0, NULL);
     if (!h) {
         perror("CreateThread failed");
-        return;
+        return FALSE;
     }
     CloseHandle(h);
+    return TRUE;
 #else // POSIX
     // Создаем detached поток
     pthread_t thread;
     pthread_attr_t attr;
     pthread_attr_init(&attr);
     pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
-    if (pthread_create(&thread, &attr, func, NULL) != 0) {
+    BOOL success = (pthread_create(&thread, &attr, func, arg) == 0);
+    if (!success) {
         perror("pthread_create failed");
     }
     pthread_attr_destroy(&attr);
+    return success;
 #endif
 }
 
+void* copy_thread_func(void* arg) {
+    // Копия, работающая потоком: использует уже отображенную 
+    // память и объекты синхронизации лидера
+    app_info* info = (app_info*) arg;
 
+    switch (info->role) {
+        case 1:
+            copy1_function();
+            break;
+        case 2:
+            copy2_function();
+            break;
+    }
 
-void main_counter_function() {
-    char start_msg[] = "Main process launched.";
-    log_msg(start_msg);
+    // После этой записи info может быть освобожден лидером
+    atomic_store(&info->thread_done, TRUE);
+    wake_main_loop();
+    return NULL;
+}
 
-    launch_daughter_thread(terminal_func);
-    data = get_data_ptr();
-    initSync();
-    initData();
+app_info* launch_copy_thread(int role) {
+    app_info* info = (app_info*) malloc(sizeof(app_info));
+    memset(info, 0, sizeof(*info));
+    info->role = role;
+    info->is_thread = TRUE;
+    atomic_init(&info->thread_done, FALSE);
 
-    app_info* copy_1_info = NULL;
-    app_info* copy_2_info = NULL;
-    BOOL copies_previously_launched = FALSE;
-    long current_pid = get_current_pid();
+    if (!launch_daughter_thread(copy_thread_func, info)) {
+        free(info);
+        return NULL;
+    }
+    return info;
+}
 
-    double now = get_curr_time();
+app_info* launch_copy(int role) {
+#ifdef COUNTER_SIM
+    return launch_sim_copy(role);
+#else
+    if (options.thread_copies)
+        return launch_copy_thread(role);
+    return launch_daughter_process(role);
+#endif
+}
 
-    time_t prev_incr_time = now;
-    time_t prev_log_counter_time = now;
-    time_t prev_copy_launch_time = now;
+void notify_change() {
+    // Сообщить ждущим (libcounter и пр.), что счетчик изменился
+    COUNTER_PROBE1(counter_change, shared_counter_load(data));
+    shared_counter_changed(data);
+}
 
-    // Основной цикл
-    while (!quit_flag) {
+void wake_main_loop() {
+#ifndef _WIN32
+    if (wake_fd != -1) {
+        uint64_t one = 1;
+        write(wake_fd, &one, sizeof(one));
+    }
+#endif
+}
 
-        // Каждый раз пытаемся стать новым лидером, если старый умер
-        lockData();
-        if (data->leader_pid == -1 || !process_is_alive(data->leader_pid))
-            data->leader_pid = current_pid;
-        BOOL is_leader = (current_pid == data->leader_pid);
-        unlockData();
 
-        now = get_curr_time();
 
-        if (now - prev_incr_time >= INCREMENT_DELAY) {
-            // Инкрементировать счетчик
-            now = get_curr_time();
-            prev_incr_time = now;
-            lockData();
-            data->counter++;
-            unlockData();
-        }
+void initEventLoop() {
+    // Основной цикл спит в epoll, пока не наступит срок какой-нибудь 
+    // задачи (timerfd), не завершится копия (signalfd, eventfd) или 
+    // не придет запрос на завершение (eventfd)
+#ifndef _WIN32
+    shutdown_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (shutdown_fd == -1) {
+        perror("eventfd failed");
+    }
 
-        if (now - prev_log_counter_time >= LOG_COUNTER_DELAY) {
-            // Записать значение счетчика в лог
-            now = get_curr_time();
-            prev_log_counter_time = now;
-            if (is_leader)
-                log_counter_val();
-        }
+    loop_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop_fd == -1) {
+        perror("epoll_create1 failed");
+        return;
+    }
 
-        if (now - prev_copy_launch_time >= LAUNCH_COPIES_DELAY) {
-            // Запустить копии (или вывести сообщение, если прошлые 
-            // копии еще не завершили работу)
+    loop_watch_fd(child_events_fd);
+    loop_watch_fd(wake_fd);
+    loop_watch_fd(shutdown_fd);
+#endif
+}
 
-            now = get_curr_time();
-            prev_copy_launch_time = now;
+void loop_watch_fd(int fd) {
+    // Добавляет дескриптор в epoll основного цикла. В data лежит сам 
+    // дескриптор; у событий управления в старших битах CONTROL_TAG, 
+    // у HTTP-метрик — METRICS_TAG.
+#ifndef _WIN32
+    if (loop_fd == -1 || fd == -1)
+        return;
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u64 = (uint64_t) fd;
+    epoll_ctl(loop_fd, EPOLL_CTL_ADD, fd, &ev);
+#endif
+}
 
-            if (is_leader) {
-                if (copies_previously_launched && (
-                    !process_is_completed(copy_1_info) ||
-                    !process_is_completed(copy_2_info))) {
-                    char msg[] = "Previously launched copies have not completed yet.";
-                    log_msg(msg);
-                }
-                else {
-                    if (copies_previously_launched) {
-                        // Закрываем предыдущие копии
-                        close_process_handle(copy_1_info);
-                        close_process_handle(copy_2_info);
-                    }
-
-                    copy_1_info = launch_daughter_process(1);
-                    copy_2_info = launch_daughter_process(2);
-                    copies_previously_launched = TRUE;
-                }
-            }
-        }
+void timer_init(loop_timer* t) {
+    t->deadline = 0;
+#ifndef _WIN32
+    t->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (t->fd == -1) {
+        perror("timerfd_create failed");
+        return;
+    }
+    loop_watch_fd(t->fd);
+#endif
+}
+
+void timer_arm(loop_timer* t, double deadline) {
+    // Взводит таймер на абсолютный момент deadline (0 — выключает)
+    if (t->deadline == deadline)
+        return;
+    t->deadline = deadline;
+
+#ifndef _WIN32
+    if (t->fd == -1)
+        return;
 
-        // Чтобы не нагружать процессор и не делать постоянно 
-        // сравнения, немного спим каждую итерацию
-        sleep_ms(MAIN_CYCLE_DELAY);
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    if (deadline > 0) {
+        // Округляем вверх, чтобы таймер не сработал раньше срока
+        spec.it_value.tv_sec = (time_t) (deadline / 1000);
+        spec.it_value.tv_nsec = (long) ((deadline - spec.it_value.tv_sec * 1000.0) * 1e6) + 1;
+        if (spec.it_value.tv_nsec >= 1000000000L) {
+            spec.it_value.tv_sec++;
+            spec.it_value.tv_nsec -= 1000000000L;
+        }
     }
+    timerfd_settime(t->fd, TFD_TIMER_ABSTIME, &spec, NULL);
+#endif
+}
 
-    lockData();
-    data->leader_pid = -1;
-    unlockData();
+BOOL timer_due(loop_timer* t, double now) {
+    return t->deadline > 0 && now >= t->deadline;
+}
 
-    if (copy_1_info || copy_2_info) {
-        await_app(copy_1_info);
-        await_app(copy_2_info);
-        close_process_handle(copy_1_info);
-        close_process_handle(copy_2_info);
+void timer_close(loop_timer* t) {
+#ifndef _WIN32
+    if (t->fd != -1) {
+        close(t->fd);
+        t->fd = -1;
     }
+#endif
+    t->deadline = 0;
+}
 
-    char exit_msg[] = "Main process completed.";
-    log_msg(exit_msg);
+void wait_loop_events(app_info** apps, int count, double deadline) {
+    // Спит до ближайшего срока deadline или до события. 
+    // Что именно произошло, цикл потом проверяет сам.
+    loop_wakeups++;
 
-    cleanupDataSync();
+#ifdef _WIN32
 
-    printf("Process terminated.\n");
-}
+    double timeout = deadline - get_curr_time();
+    if (timeout > config.main_cycle_delay) timeout = config.main_cycle_delay;
+    if (timeout < 0) timeout = 0;
+    wait_child_events(apps, count, (unsigned long) timeout);
 
-void* terminal_func(void* arg) {
-    // Отдельный поток ждет ввода в командную строку и 
-    // изменяет значение счетчика при вводе
+#else // POSIX
 
-    char buffer[64];
-    char *ptr;
-    printf("Enter a number to change the value of the counter\n"\
-           "or leave a blank line to terminate the process.\n");
+    // Сроки задач взведены в timerfd, отдельный таймаут не нужен
+    (void) deadline;
 
-    while (!quit_flag) {
-        if (fgets(buffer, sizeof(buffer), stdin) == NULL) {
-            quit_flag = TRUE;
-            break;
-        }
+    if (loop_fd == -1) {
+        // epoll недоступен — просыпаемся по старому
+        wait_child_events(apps, count, config.main_cycle_delay);
+        return;
+    }
 
-        // Убираем \n и \r\n
-        buffer[strcspn(buffer, "\r\n")] = '\0';
-        // Убираем пробелы на концах
-        char* trimmed = trimspaces(buffer);
+    struct epoll_event events[8];
+    int ready = epoll_wait(loop_fd, events, 8, -1);
 
-        if (trimmed[0] == '\0') {
-            // Если строка была пустой
-            printf("Terminating process...\n");
-            quit_flag = TRUE;
-            break;
+    // Вычитываем все сработавшие дескрипторы: у timerfd и eventfd 
+    // это 8-байтный счетчик, у signalfd — структуры siginfo
+    for (int i = 0; i < ready; i++) {
+        if ((events[i].data.u64 >> 32) == CONTROL_TAG) {
+            control_handle_event((uint32_t) events[i].data.u64, events[i].events);
+            continue;
         }
+        if ((events[i].data.u64 >> 32) == METRICS_TAG) {
+            metrics_handle_event((uint32_t) events[i].data.u64, events[i].events);
+            continue;
+        }
+
+        int fd = (int) events[i].data.u64;
+        if (fd == child_events_fd) {
+            struct signalfd_siginfo info;
+            while (read(fd, &info, sizeof(info)) == sizeof(info)) {}
+        } else if (fd == config_watch_fd) {
+            handle_config_events();
+        } else if (fd == shutdown_fd) {
+            // Не вычитываем: shutdown_fd остается готовым к чтению, 
+            // чтобы его видели и остальные потоки
+        } else {
+            uint64_t value;
+            read(fd, &value, sizeof(value));
+        }
+    }
+
+#endif
+}
+
+void request_shutdown() {
+    // Повторные запросы ничего не меняют, время берется по первому
+    if (atomic_exchange(&quit_flag, TRUE))
+        return;
+    atomic_store(&shutdown_requested_ns, get_curr_time_ns());
+#ifndef _WIN32
+    if (shutdown_fd != -1) {
+        uint64_t one = 1;
+        write(shutdown_fd, &one, sizeof(one));
+    }
+#endif
+}
+
+BOOL wait_shutdown(unsigned long ms) {
+    // Сон на ms, который прерывается запросом на завершение. 
+    // Возвращает TRUE, если завершение запрошено
+#ifdef _WIN32
+    // Копии-потоки проверяют флажок между короткими снами
+    double deadline = get_curr_time() + ms;
+    while (!atomic_load(&quit_flag)) {
+        double left = deadline - get_curr_time();
+        if (left <= 0)
+            return FALSE;
+        Sleep((DWORD) (left < 10 ? left : 10));
+    }
+    return TRUE;
+#else // POSIX
+    if (shutdown_fd == -1) {
+        sleep_ms(ms);
+        return atomic_load(&quit_flag);
+    }
+
+    double deadline = get_curr_time() + ms;
+    struct pollfd pfd;
+    pfd.fd = shutdown_fd;
+    pfd.events = POLLIN;
+    for (;;) {
+        double left = deadline - get_curr_time();
+        int ready = poll(&pfd, 1, left > 0 ? (int) (left + 0.999) : 0);
+        if (ready > 0)
+            return TRUE;
+        if (ready == 0 || errno != EINTR)
+            return atomic_load(&quit_flag);
+    }
+#endif
+}
+
+void initShutdownSignal() {
+    // В копии-процессе запрос на завершение приходит от лидера 
+    // сигналом SIGTERM. Сигнал блокируется (это делает еще лидер 
+    // до execv, см. launch_daughter_process) и читается через 
+    // signalfd, так что wait_shutdown работает так же, как в лидере
+#ifndef _WIN32
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+    shutdown_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (shutdown_fd == -1) {
+        perror("signalfd failed");
+    }
+#endif
+}
+
+void stop_app(app_info* app_info) {
+    // Просит копию закончить раньше. Копии-потоки сами видят 
+    // shutdown_fd, копиям-процессам посылаем SIGTERM
+    if (!app_info || app_info->completed || app_info->is_thread)
+        return;
+#ifndef _WIN32
+    kill(app_info->pid, SIGTERM);
+#endif
+}
+
+void cleanupEventLoop() {
+#ifndef _WIN32
+    if (loop_fd != -1) {
+        close(loop_fd);
+        loop_fd = -1;
+    }
+    if (config_watch_fd != -1) {
+        close(config_watch_fd);
+        config_watch_fd = -1;
+    }
+    // shutdown_fd не закрываем: терминальный поток может 
+    // писать в него до самого завершения процесса
+#endif
+}
+
+
+
+void put_u64(unsigned char* buf, uint64_t value) {
+    for (int i = 0; i < 8; i++)
+        buf[i] = (unsigned char) (value >> (8 * i));
+}
+
+uint64_t get_u64(unsigned char* buf) {
+    uint64_t value = 0;
+    for (int i = 0; i < 8; i++)
+        value |= (uint64_t) buf[i] << (8 * i);
+    return value;
+}
+
+BOOL control_start() {
+    // Лидер начинает слушать CONTROL_SOCKET. Сокет мог остаться от 
+    // умершего лидера, поэтому сначала удаляем его.
+#ifndef _WIN32
+    if (control_listen_fd != -1)
+        return TRUE;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        perror("socket failed");
+        return FALSE;
+    }
+
+    char path[NAME_SIZE];
+    shared_name(CONTROL_SOCKET, path, sizeof(path));
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    unlink(path);
+
+    if (bind(fd, (struct sockaddr*) &addr, sizeof(addr)) == -1 || listen(fd, SOMAXCONN) == -1) {
+        // EADDRINUSE — прежний лидер еще не узнал, что лидерство 
+        // перешло (новый экземпляр забирает его в initData); 
+        // попробуем снова при следующем пробуждении
+        if (errno != EADDRINUSE)
+            perror("control socket failed");
+        close(fd);
+        return FALSE;
+    }
+
+    control_listen_fd = fd;
+    struct stat st;
+    control_socket_ino = (stat(path, &st) == 0) ? st.st_ino : 0;
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u64 = (CONTROL_TAG << 32) | MAX_CONTROL_CLIENTS;   // индекс за пределами массива — сам сокет
+    epoll_ctl(loop_fd, EPOLL_CTL_ADD, fd, &ev);
+    return TRUE;
+#else
+    return FALSE;
+#endif
+}
+
+void control_stop() {
+#ifndef _WIN32
+    for (int i = 0; i < MAX_CONTROL_CLIENTS; i++) {
+        if (control_clients[i])
+            control_close_client(control_clients[i]);
+    }
+    if (control_listen_fd != -1) {
+        close(control_listen_fd);
+        control_listen_fd = -1;
+        // Файл удаляется, только если он все еще наш: новый лидер 
+        // мог уже создать свой сокет на том же месте
+        char path[NAME_SIZE];
+        shared_name(CONTROL_SOCKET, path, sizeof(path));
+        struct stat st;
+        if (stat(path, &st) == 0 && st.st_ino == control_socket_ino)
+            unlink(path);
+    }
+#endif
+}
+
+void control_accept() {
+#ifndef _WIN32
+    for (;;) {
+        int fd = accept(control_listen_fd, NULL, NULL);
+        if (fd == -1)
+            return;
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+        int index = 0;
+        while (index < MAX_CONTROL_CLIENTS && control_clients[index])
+            index++;
+        if (index == MAX_CONTROL_CLIENTS) {
+            // Мест нет — отказываем
+            close(fd);
+            continue;
+        }
+
+        control_client* c = (control_client*) malloc(sizeof(control_client));
+        c->fd = fd;
+        c->index = index;
+        c->watching = FALSE;
+        c->epoll_events = EPOLLIN;
+        c->last_value = 0;
+        c->in_len = 0;
+        c->out_len = 0;
+        control_clients[index] = c;
+
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.u64 = (CONTROL_TAG << 32) | (uint64_t) index;
+        epoll_ctl(loop_fd, EPOLL_CTL_ADD, fd, &ev);
+    }
+#endif
+}
+
+void control_close_client(control_client* c) {
+#ifndef _WIN32
+    if (c->watching)
+        control_watchers--;
+    close(c->fd);   // закрытый дескриптор сам уходит из epoll
+    control_clients[c->index] = NULL;
+    free(c);
+#endif
+}
+
+void control_update_events(control_client* c) {
+    // Пока клиент не забрал ответы, новые запросы от него не читаем; 
+    // при полном входном буфере читать тоже некуда
+#ifndef _WIN32
+    uint32_t wanted = 0;
+    if (c->out_len > 0)
+        wanted = EPOLLOUT;
+    else if (c->in_len < CONTROL_IN_SIZE)
+        wanted = EPOLLIN;
+    if (c->epoll_events == wanted)
+        return;
+    c->epoll_events = wanted;
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = wanted;
+    ev.data.u64 = (CONTROL_TAG << 32) | (uint64_t) c->index;
+    epoll_ctl(loop_fd, EPOLL_CTL_MOD, c->fd, &ev);
+#endif
+}
+
+void control_flush(control_client* c) {
+#ifndef _WIN32
+    size_t sent = 0;
+    while (sent < c->out_len) {
+        ssize_t n = write(c->fd, c->out + sent, c->out_len - sent);
+        if (n <= 0)
+            break;
+        sent += (size_t) n;
+    }
+    memmove(c->out, c->out + sent, c->out_len - sent);
+    c->out_len -= sent;
+
+    control_update_events(c);
+#endif
+}
+
+void control_process(control_client* c) {
+    // Выполняет все целые запросы из входного буфера под одной 
+    // блокировкой, пока хватает места для ответов
+    size_t pos = 0;
+    BOOL changed = FALSE;
+
+    lockData();
+    while (c->in_len - pos >= CONTROL_MSG_SIZE && 
+           c->out_len + CONTROL_MSG_SIZE <= CONTROL_OUT_SIZE) {
+        unsigned char op = c->in[pos];
+        uint64_t value = get_u64(c->in + pos + 1);
+        unsigned char status = CONTROL_OK;
+
+        switch (op) {
+            case CONTROL_GET:
+                break;
+            case CONTROL_SET:
+                data->counter = value;
+                changed = TRUE;
+                break;
+            case CONTROL_ADD:
+                data->counter += value;
+                changed = TRUE;
+                break;
+            case CONTROL_WATCH:
+                if (!c->watching) {
+                    control_watchers++;
+                    control_watch_start();
+                }
+                c->watching = TRUE;
+                c->last_value = data->counter;
+                break;
+            default:
+                status = CONTROL_ERROR;
+                break;
+        }
+
+        c->out[c->out_len] = status;
+        put_u64(c->out + c->out_len + 1, data->counter);
+        c->out_len += CONTROL_MSG_SIZE;
+        pos += CONTROL_MSG_SIZE;
+    }
+    unlockData();
+    if (changed)
+        notify_change();
+
+    memmove(c->in, c->in + pos, c->in_len - pos);
+    c->in_len -= pos;
+}
+
+void control_handle_event(uint32_t index, uint32_t events) {
+#ifndef _WIN32
+    if (index == MAX_CONTROL_CLIENTS) {
+        control_accept();
+        return;
+    }
+
+    control_client* c = control_clients[index];
+    if (!c)
+        return;
+
+    // При полном буфере не читаем: read нуля байт вернул бы 0, 
+    // как при закрытии соединения
+    size_t room = CONTROL_IN_SIZE - c->in_len;
+    if ((events & EPOLLIN) && room > 0) {
+        ssize_t n = read(c->fd, c->in + c->in_len, room);
+        if (n == 0 || (n < 0 && errno != EAGAIN)) {
+            control_close_client(c);
+            return;
+        }
+        if (n > 0)
+            c->in_len += (size_t) n;
+    }
+    else if (events & (EPOLLERR | EPOLLHUP)) {
+        control_close_client(c);
+        return;
+    }
+
+    // Запросы, отложенные из-за полного выходного буфера, 
+    // выполняем после того, как он освободится
+    control_flush(c);
+    control_process(c);
+    control_flush(c);
+#endif
+}
+
+void control_notify_watchers() {
+    // Подписчики получают последнее значение счетчика (промежуточные 
+    // изменения между пробуждениями цикла склеиваются). Цикл будит 
+    // control_watch_func, как только счетчик меняется
+#ifndef _WIN32
+    if (control_watchers == 0)
+        return;
+
+    lockData();
+    counter_t value = data->counter;
+    unlockData();
+
+    for (int i = 0; i < MAX_CONTROL_CLIENTS; i++) {
+        control_client* c = control_clients[i];
+        if (!c || !c->watching || c->last_value == value)
+            continue;
+        if (c->out_len + CONTROL_MSG_SIZE > CONTROL_OUT_SIZE)
+            continue;   // клиент не успевает читать — отправим позже
+
+        c->out[c->out_len] = CONTROL_EVENT;
+        put_u64(c->out + c->out_len + 1, value);
+        c->out_len += CONTROL_MSG_SIZE;
+        c->last_value = value;
+        control_flush(c);
+    }
+#endif
+}
+
+void control_watch_start() {
+    // Поток запускается с первым подписчиком и сам завершается, 
+    // когда их не остается: без подписчиков он не ждет на change_seq, 
+    // и изменения счетчика не платят за FUTEX_WAKE
+#ifndef _WIN32
+    int running = FALSE;
+    if (atomic_compare_exchange_strong(&control_watch_running, &running, TRUE) &&
+        !launch_daughter_thread(control_watch_func, NULL))
+        atomic_store(&control_watch_running, FALSE);
+#endif
+}
+
+void* control_watch_func(void* arg) {
+    // Ждет изменения счетчика (от любого экземпляра или libcounter) 
+    // и будит основной цикл, который разошлет его подписчикам
+    (void) arg;
+#ifndef _WIN32
+    counter_t last = shared_counter_load(data);
+    for (;;) {
+        while (atomic_load(&control_watchers) > 0 && !atomic_load(&quit_flag)) {
+            if (shared_counter_wait(data, last, &last, CONTROL_WATCH_POLL))
+                wake_main_loop();
+        }
+        atomic_store(&control_watch_running, FALSE);
+
+        // Подписчик мог появиться, пока мы выходили, а control_watch_start 
+        // видел поток еще запущенным
+        int running = FALSE;
+        if (atomic_load(&control_watchers) == 0 || atomic_load(&quit_flag) ||
+            !atomic_compare_exchange_strong(&control_watch_running, &running, TRUE))
+            break;
+    }
+#endif
+    return NULL;
+}
+
+
+
+BOOL metrics_start() {
+    // Лидер открывает HTTP-метрики на 127.0.0.1:options.metrics_port
+#ifndef _WIN32
+    if (metrics_listen_fd != -1)
+        return TRUE;
+    if (options.metrics_port <= 0)
+        return FALSE;
+
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        perror("socket failed");
+        return FALSE;
+    }
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t) options.metrics_port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (bind(fd, (struct sockaddr*) &addr, sizeof(addr)) == -1 || listen(fd, SOMAXCONN) == -1) {
+        // EADDRINUSE — порт еще держит прежний лидер; 
+        // попробуем снова при следующем пробуждении
+        if (errno != EADDRINUSE)
+            perror("metrics socket failed");
+        close(fd);
+        return FALSE;
+    }
+
+    metrics_listen_fd = fd;
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u64 = (METRICS_TAG << 32) | MAX_METRICS_CLIENTS;   // индекс за пределами массива — сам сокет
+    epoll_ctl(loop_fd, EPOLL_CTL_ADD, fd, &ev);
+
+    // Первый запрос не должен ждать METRICS_REFRESH
+    metrics_refresh(get_curr_time());
+    return TRUE;
+#else
+    return FALSE;
+#endif
+}
+
+void metrics_stop() {
+#ifndef _WIN32
+    for (int i = 0; i < MAX_METRICS_CLIENTS; i++) {
+        if (metrics_clients[i])
+            metrics_close_client(metrics_clients[i]);
+    }
+    if (metrics_listen_fd != -1) {
+        close(metrics_listen_fd);
+        metrics_listen_fd = -1;
+    }
+#endif
+    // Следующий лидер начнет считать темп заново
+    metrics.valid = FALSE;
+}
+
+void metrics_accept() {
+#ifndef _WIN32
+    for (;;) {
+        int fd = accept(metrics_listen_fd, NULL, NULL);
+        if (fd == -1)
+            return;
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+        int index = 0;
+        while (index < MAX_METRICS_CLIENTS && metrics_clients[index])
+            index++;
+        if (index == MAX_METRICS_CLIENTS) {
+            close(fd);
+            continue;
+        }
+
+        metrics_client* c = (metrics_client*) malloc(sizeof(metrics_client));
+        c->fd = fd;
+        c->index = index;
+        c->in_len = 0;
+        c->out_len = 0;
+        c->out_pos = 0;
+        metrics_clients[index] = c;
+
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.u64 = (METRICS_TAG << 32) | (uint64_t) index;
+        epoll_ctl(loop_fd, EPOLL_CTL_ADD, fd, &ev);
+    }
+#endif
+}
+
+void metrics_close_client(metrics_client* c) {
+#ifndef _WIN32
+    close(c->fd);
+    metrics_clients[c->index] = NULL;
+    free(c);
+#endif
+}
+
+void metrics_flush(metrics_client* c) {
+    // Отправляет ответ; что не влезло в сокет — допишем по EPOLLOUT
+#ifndef _WIN32
+    while (c->out_pos < c->out_len) {
+        ssize_t n = write(c->fd, c->out + c->out_pos, c->out_len - c->out_pos);
+        if (n < 0 && errno == EAGAIN) {
+            struct epoll_event ev;
+            memset(&ev, 0, sizeof(ev));
+            ev.events = EPOLLOUT;
+            ev.data.u64 = (METRICS_TAG << 32) | (uint64_t) c->index;
+            epoll_ctl(loop_fd, EPOLL_CTL_MOD, c->fd, &ev);
+            return;
+        }
+        if (n <= 0)
+            break;
+        c->out_pos += (size_t) n;
+    }
+    metrics_close_client(c);
+#endif
+}
+
+void metrics_handle_event(uint32_t index, uint32_t events) {
+#ifndef _WIN32
+    if (index == MAX_METRICS_CLIENTS) {
+        metrics_accept();
+        return;
+    }
+
+    metrics_client* c = metrics_clients[index];
+    if (!c)
+        return;
+
+    if (c->out_len > 0) {
+        // Ответ уже собран, ждали места в сокете
+        if (events & (EPOLLERR | EPOLLHUP))
+            metrics_close_client(c);
+        else
+            metrics_flush(c);
+        return;
+    }
+
+    if (events & EPOLLIN) {
+        ssize_t n = read(c->fd, c->in + c->in_len, METRICS_IN_SIZE - 1 - c->in_len);
+        if (n == 0 || (n < 0 && errno != EAGAIN)) {
+            metrics_close_client(c);
+            return;
+        }
+        if (n > 0)
+            c->in_len += (size_t) n;
+    }
+    else if (events & (EPOLLERR | EPOLLHUP)) {
+        metrics_close_client(c);
+        return;
+    }
+
+    // Ждем конца заголовка; тело запроса нам не нужно
+    c->in[c->in_len] = '\0';
+    BOOL complete = strstr(c->in, "\r\n\r\n") || strstr(c->in, "\n\n");
+    if (!complete && c->in_len < METRICS_IN_SIZE - 1)
+        return;
+
+    char body[METRICS_OUT_SIZE];
+    size_t body_len;
+    char* status;
+    if (complete && (strncmp(c->in, "GET /metrics ", 13) == 0 || strncmp(c->in, "GET / ", 6) == 0)) {
+        metrics.scrapes++;
+        body_len = metrics_render(&metrics, get_curr_time(), body, sizeof(body));
+        status = "200 OK";
+    } else {
+        body_len = (size_t) snprintf(body, sizeof(body), "Only GET /metrics is served.\n");
+        status = complete ? "404 Not Found" : "400 Bad Request";
+    }
+
+    int header_len = snprintf(c->out, METRICS_OUT_SIZE, 
+        "HTTP/1.0 %s\r\n"
+        "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+        "Content-Length: %zu\r\n"
+        "Connection: close\r\n\r\n", status, body_len);
+    if (header_len + body_len > METRICS_OUT_SIZE)
+        body_len = METRICS_OUT_SIZE - header_len;
+    memcpy(c->out + header_len, body, body_len);
+    c->out_len = header_len + body_len;
+    metrics_flush(c);
+#endif
+}
+
+void metrics_refresh(double now) {
+    // Снимок собирается без lockData: counter читается атомарно, 
+    // статистика — relaxed-атомиками
+    metrics_snapshot m;
+    memset(&m, 0, sizeof(m));
+    m.valid = TRUE;
+    m.taken_at = now;
+    m.value = shared_counter_load(data);
+    m.leader_pid = get_current_pid();
+    m.scrapes = metrics.scrapes;
+
+    if (stats) {
+        for (int i = 0; i < EVENT_COUNT; i++)
+            m.events[i] = atomic_load_explicit(&stats->events[i], memory_order_relaxed);
+
+        stat_snapshot snap;
+        stat_snapshot_take(&stats->hist[STAT_LOG_WRITE], &snap);
+        m.log_lines = snap.count;
+        stat_snapshot_take(&stats->hist[STAT_LOCK_WAIT], &snap);
+        m.lock_acquisitions = snap.count;
+        m.lock_contended = snap.count - snap.buckets[0];   // в нулевой корзине — взятые сразу
+        m.lock_wait_ns = snap.total_ns;
+    }
+
+    // Темп — по двум последним снимкам (после counter_stat --reset 
+    // счетчик уменьшается, тогда темп считаем нулевым)
+    if (metrics.valid && now > metrics.taken_at && 
+        m.events[EVENT_INCREMENTS] >= metrics.events[EVENT_INCREMENTS]) {
+        m.increments_rate = (m.events[EVENT_INCREMENTS] - metrics.events[EVENT_INCREMENTS]) / 
+            ((now - metrics.taken_at) / 1000.0);
+    }
+
+    metrics = m;
+}
+
+void metrics_append(char* buf, size_t size, size_t* len, const char* fmt, ...) {
+    if (*len >= size)
+        return;
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(buf + *len, size - *len, fmt, args);
+    va_end(args);
+    if (n > 0)
+        *len = (*len + n < size) ? *len + n : size - 1;
+}
+
+size_t metrics_render(metrics_snapshot* m, double now, char* buf, size_t size) {
+    // Текстовый формат Prometheus (version 0.0.4)
+    size_t len = 0;
+    buf[0] = '\0';
+
+    metrics_append(buf, size, &len, 
+        "# HELP counter_value Current counter value.\n"
+        "# TYPE counter_value gauge\n"
+        "counter_value %llu\n", m->value);
+    metrics_append(buf, size, &len, 
+        "# HELP counter_increments_total Periodic and high-frequency increments.\n"
+        "# TYPE counter_increments_total counter\n"
+        "counter_increments_total %llu\n", m->events[EVENT_INCREMENTS]);
+    metrics_append(buf, size, &len, 
+        "# HELP counter_increments_per_second Increment rate between the last two snapshots.\n"
+        "# TYPE counter_increments_per_second gauge\n"
+        "counter_increments_per_second %.3f\n", m->increments_rate);
+    metrics_append(buf, size, &len, 
+        "# HELP counter_leader_pid PID of the instance serving these metrics.\n"
+        "# TYPE counter_leader_pid gauge\n"
+        "counter_leader_pid %ld\n", m->leader_pid);
+    metrics_append(buf, size, &len, 
+        "# HELP counter_leader_changes_total Times leadership moved to another instance.\n"
+        "# TYPE counter_leader_changes_total counter\n"
+        "counter_leader_changes_total %llu\n", m->events[EVENT_LEADER_CHANGES]);
+
+    metrics_append(buf, size, &len, 
+        "# HELP counter_copy_launches_total Copies launched.\n"
+        "# TYPE counter_copy_launches_total counter\n"
+        "counter_copy_launches_total{role=\"1\"} %llu\n"
+        "counter_copy_launches_total{role=\"2\"} %llu\n", 
+        m->events[EVENT_COPY1_LAUNCHED], m->events[EVENT_COPY2_LAUNCHED]);
+    metrics_append(buf, size, &len, 
+        "# HELP counter_copy_completions_total Copies reaped after completion.\n"
+        "# TYPE counter_copy_completions_total counter\n"
+        "counter_copy_completions_total{role=\"1\"} %llu\n"
+        "counter_copy_completions_total{role=\"2\"} %llu\n", 
+        m->events[EVENT_COPY1_COMPLETED], m->events[EVENT_COPY2_COMPLETED]);
+    metrics_append(buf, size, &len, 
+        "# HELP counter_copy_launches_dropped_total Launches skipped because the copy queue was full.\n"
+        "# TYPE counter_copy_launches_dropped_total counter\n"
+        "counter_copy_launches_dropped_total{role=\"1\"} %llu\n"
+        "counter_copy_launches_dropped_total{role=\"2\"} %llu\n", 
+        m->events[EVENT_COPY1_DROPPED], m->events[EVENT_COPY2_DROPPED]);
+    metrics_append(buf, size, &len, 
+        "# HELP counter_launch_cycles_busy_total Launch cycles that found previous copies still running.\n"
+        "# TYPE counter_launch_cycles_busy_total counter\n"
+        "counter_launch_cycles_busy_total %llu\n", m->events[EVENT_LAUNCH_BUSY]);
+
+    metrics_append(buf, size, &len, 
+        "# HELP counter_log_lines_total Lines written to the log.\n"
+        "# TYPE counter_log_lines_total counter\n"
+        "counter_log_lines_total %llu\n", m->log_lines);
+    metrics_append(buf, size, &len, 
+        "# HELP counter_log_bytes_total Bytes written to the log.\n"
+        "# TYPE counter_log_bytes_total counter\n"
+        "counter_log_bytes_total %llu\n", m->events[EVENT_LOG_BYTES]);
+
+    metrics_append(buf, size, &len, 
+        "# HELP counter_lock_acquisitions_total Acquisitions of the shared data lock.\n"
+        "# TYPE counter_lock_acquisitions_total counter\n"
+        "counter_lock_acquisitions_total %llu\n", m->lock_acquisitions);
+    metrics_append(buf, size, &len, 
+        "# HELP counter_lock_contended_total Acquisitions that had to wait for the lock.\n"
+        "# TYPE counter_lock_contended_total counter\n"
+        "counter_lock_contended_total %llu\n", m->lock_contended);
+    metrics_append(buf, size, &len, 
+        "# HELP counter_lock_wait_seconds_total Time spent waiting for the lock.\n"
+        "# TYPE counter_lock_wait_seconds_total counter\n"
+        "counter_lock_wait_seconds_total %.9f\n", m->lock_wait_ns / 1e9);
+
+    metrics_append(buf, size, &len, 
+        "# HELP counter_lock_recoveries_total Times the lock was released on behalf of a dead holder.\n"
+        "# TYPE counter_lock_recoveries_total counter\n"
+        "counter_lock_recoveries_total %llu\n", m->events[EVENT_LOCK_RECOVERIES]);
+
+    metrics_append(buf, size, &len, 
+        "# HELP counter_metrics_snapshot_age_seconds Age of the snapshot served.\n"
+        "# TYPE counter_metrics_snapshot_age_seconds gauge\n"
+        "counter_metrics_snapshot_age_seconds %.3f\n", (now - m->taken_at) / 1000.0);
+    metrics_append(buf, size, &len, 
+        "# HELP counter_metrics_scrapes_total Scrapes served by this leader.\n"
+        "# TYPE counter_metrics_scrapes_total counter\n"
+        "counter_metrics_scrapes_total %llu\n", m->scrapes);
+    return len;
+}
+
+void metrics_task(wheel_timer* t, void* arg) {
+    // Обновить снимок метрик
+    (void) t;
+    counter_loop* loop = (counter_loop*) arg;
+#ifndef _WIN32
+    if (loop->is_leader && metrics_listen_fd != -1)
+        metrics_refresh(get_curr_time());
+#endif
+}
+
+
+
+uint64_t wheel_ticks_ceil(timer_wheel* w, double time) {
+    double ticks = (time - w->origin) / WHEEL_TICK;
+    if (ticks <= 0)
+        return 0;
+    uint64_t result = (uint64_t) ticks;
+    return (result < ticks) ? result + 1 : result;
+}
+
+int wheel_find_slot(uint64_t* bits, int from) {
+    // Первая непустая ячейка, начиная с from (по кругу); -1 — все пусты
+    for (int i = 0; i < WHEEL_SIZE / 64; i++) {
+        int word = ((from >> 6) + i) % (WHEEL_SIZE / 64);
+        uint64_t mask = bits[word];
+        if (i == 0)
+            mask &= ~0ULL << (from & 63);
+        if (mask)
+            return word * 64 + __builtin_ctzll(mask);
+    }
+    // Биты первого слова до from
+    uint64_t mask = bits[from >> 6] & ~(~0ULL << (from & 63));
+    if (mask)
+        return (from >> 6) * 64 + __builtin_ctzll(mask);
+    return -1;
+}
+
+void wheel_init(timer_wheel* w, double now) {
+    memset(w, 0, sizeof(*w));
+    w->origin = now;
+}
+
+void wheel_timer_init(wheel_timer* t, wheel_callback func, void* arg) {
+    memset(t, 0, sizeof(*t));
+    t->func = func;
+    t->arg = arg;
+}
+
+void wheel_link(timer_wheel* w, wheel_timer* t) {
+    // Кладет задачу в ячейку по удаленности ее срока от текущего тика
+    uint64_t expires = (t->expires < w->current) ? w->current : t->expires;
+    uint64_t delta = expires - w->current;
+
+    int level = 0;
+    while (level < WHEEL_LEVELS - 1 && delta >= (1ULL << (WHEEL_BITS * (level + 1))))
+        level++;
+    if (delta >= (1ULL << (WHEEL_BITS * WHEEL_LEVELS)))
+        expires = w->current + (1ULL << (WHEEL_BITS * WHEEL_LEVELS)) - 1;
+
+    int slot = (int) ((expires >> (WHEEL_BITS * level)) & WHEEL_MASK);
+    wheel_timer** head = &w->slots[level][slot];
+
+    t->level = level;
+    t->slot = slot;
+    t->next = *head;
+    if (t->next)
+        t->next->pprev = &t->next;
+    *head = t;
+    t->pprev = head;
+    w->occupied[level][slot >> 6] |= 1ULL << (slot & 63);
+}
+
+void wheel_unlink(timer_wheel* w, wheel_timer* t) {
+    *t->pprev = t->next;
+    if (t->next)
+        t->next->pprev = t->pprev;
+    if (!w->slots[t->level][t->slot])
+        w->occupied[t->level][t->slot >> 6] &= ~(1ULL << (t->slot & 63));
+    t->next = NULL;
+    t->pprev = NULL;
+}
+
+void wheel_add(timer_wheel* w, wheel_timer* t, double deadline, double period) {
+    // Регистрирует задачу на абсолютный момент deadline (in ms) с 
+    // периодом period (0 — одноразовая). Уже активная задача переносится.
+    if (t->active)
+        wheel_unlink(w, t);
+    else
+        w->count++;
+
+    t->active = TRUE;
+    t->expires = wheel_ticks_ceil(w, deadline);
+    t->first_expires = t->expires;
+    t->total_runs = 0;      // статистика считается с момента регистрации
+    t->skipped = 0;
+    t->period = (period > 0) ? wheel_ticks_ceil(w, w->origin + period) : 0;
+    wheel_link(w, t);
+}
+
+void wheel_cancel(timer_wheel* w, wheel_timer* t) {
+    if (!t->active)
+        return;
+    if (t->pprev)
+        wheel_unlink(w, t);
+    t->active = FALSE;
+    w->count--;
+}
+
+int wheel_advance(timer_wheel* w, double now) {
+    // Выполняет все задачи со сроком не позже now. 
+    // Возвращает количество сработавших задач.
+    if (now < w->origin)
+        return 0;
+    uint64_t target = (uint64_t) ((now - w->origin) / WHEEL_TICK);
+    int expired = 0;
+
+    while (w->current <= target) {
+        if (w->count == 0) {
+            w->current = target + 1;
+            break;
+        }
+
+        uint64_t tick = w->current;
+        int idx = (int) (tick & WHEEL_MASK);
+
+        // На границе оборота спускаем задачи со старших уровней
+        for (int level = 1; idx == 0 && level < WHEEL_LEVELS; level++) {
+            int slot = (int) ((tick >> (WHEEL_BITS * level)) & WHEEL_MASK);
+            wheel_timer* list = w->slots[level][slot];
+            w->slots[level][slot] = NULL;
+            w->occupied[level][slot >> 6] &= ~(1ULL << (slot & 63));
+            while (list) {
+                wheel_timer* t = list;
+                list = t->next;
+                wheel_link(w, t);
+            }
+            if (slot != 0)
+                break;
+        }
+
+        // Забираем ячейку целиком: задачи, добавленные из обработчиков, 
+        // попадут уже в следующие тики
+        wheel_timer* list = w->slots[0][idx];
+        w->slots[0][idx] = NULL;
+        w->occupied[0][idx >> 6] &= ~(1ULL << (idx & 63));
+        if (list)
+            list->pprev = &list;
+        w->current = tick + 1;
+
+        while (list) {
+            wheel_timer* t = list;
+            list = t->next;
+            if (list)
+                list->pprev = &list;
+            t->next = NULL;
+            t->pprev = NULL;
+
+            if (t->lateness) {
+                double late = now - (w->origin + (double) t->expires * WHEEL_TICK);
+                histogram_record(t->lateness, late);
+                stat_record(STAT_LOOP_LATENESS, (uint64_t) (late * 1e6));
+            }
+
+            t->runs = 1;
+            if (t->period) {
+                // Следующий срок считаем от прошлого срока, а не от 
+                // момента срабатывания, поэтому опоздания не копятся
+                t->expires += t->period;
+                if (t->expires <= target && t->policy != CATCH_UP_BURST) {
+                    // Сроки, которые тоже уже прошли
+                    uint64_t missed = (target - t->expires) / t->period + 1;
+                    t->expires += missed * t->period;
+                    if (t->policy == CATCH_UP_COALESCE)
+                        t->runs += missed;
+                    else
+                        t->skipped += missed;
+                }
+                wheel_link(w, t);
+            } else {
+                t->active = FALSE;
+                w->count--;
+            }
+
+            t->total_runs += t->runs;
+            expired++;
+            t->func(t, t->arg);
+        }
+
+        // Пропускаем пустые ячейки до ближайшей занятой или до границы оборота
+        if (w->current > target || (w->current & WHEEL_MASK) == 0)
+            continue;
+        int from = (int) (w->current & WHEEL_MASK);
+        int next = wheel_find_slot(w->occupied[0], from);
+        uint64_t skip_to = (w->current | WHEEL_MASK) + 1;
+        if (next >= from)
+            skip_to = (w->current & ~(uint64_t) WHEEL_MASK) + next;
+        w->current = (skip_to < target + 1) ? skip_to : target + 1;
+    }
+
+    return expired;
+}
+
+double wheel_next_expiry(timer_wheel* w) {
+    // Ближайший срок среди всех задач (in ms); 0 — задач нет
+    if (w->count == 0)
+        return 0;
+
+    uint64_t best = UINT64_MAX;
+
+    int idx = (int) (w->current & WHEEL_MASK);
+    int slot = wheel_find_slot(w->occupied[0], idx);
+    if (slot >= 0)
+        best = w->current + ((slot - idx) & WHEEL_MASK);
+
+    for (int level = 1; level < WHEEL_LEVELS; level++) {
+        // Ячейки старших уровней покрывают интервалы, поэтому точный 
+        // срок ищем по спискам: в ячейке текущего оборота и в ближайшей 
+        // следующей непустой
+        int cur = (int) ((w->current >> (WHEEL_BITS * level)) & WHEEL_MASK);
+        int candidates[2] = { cur, wheel_find_slot(w->occupied[level], (cur + 1) & WHEEL_MASK) };
+        for (int i = 0; i < 2; i++) {
+            if (candidates[i] < 0)
+                continue;
+            for (wheel_timer* t = w->slots[level][candidates[i]]; t; t = t->next) {
+                uint64_t expires = (t->expires < w->current) ? w->current : t->expires;
+                if (expires < best)
+                    best = expires;
+            }
+        }
+    }
+
+    return w->origin + (double) best * WHEEL_TICK;
+}
+
+unsigned long long wheel_expected_runs(timer_wheel* w, wheel_timer* t) {
+    // Сколько сроков периодической задачи уже наступило по колесу: 
+    // при CATCH_UP_BURST и CATCH_UP_COALESCE равно t->total_runs, 
+    // при CATCH_UP_SKIP — t->total_runs + t->skipped
+    if (!t->period || w->current <= t->first_expires)
+        return 0;
+    return (w->current - 1 - t->first_expires) / t->period + 1;
+}
+
+void histogram_record(lateness_histogram* h, double value) {
+    // value in ms; корзины по степеням двойки в микросекундах
+    double us = value * 1000.0;
+    int bucket = 0;
+    while (bucket < LATENESS_BUCKETS - 1 && us >= (double) (1ULL << bucket))
+        bucket++;
+
+    h->buckets[bucket]++;
+    h->count++;
+    h->total += value;
+    if (value > h->max)
+        h->max = value;
+}
+
+double histogram_percentile(lateness_histogram* h, double p) {
+    // Верхняя граница корзины, в которую попадает p-й перцентиль, in ms
+    if (h->count == 0)
+        return 0;
+
+    unsigned long long rank = (unsigned long long) (p / 100.0 * h->count);
+    if (rank >= h->count)
+        rank = h->count - 1;
+
+    unsigned long long seen = 0;
+    for (int i = 0; i < LATENESS_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen > rank) {
+            double bound = (double) (1ULL << i) / 1000.0;
+            return (i == LATENESS_BUCKETS - 1 || bound > h->max) ? h->max : bound;
+        }
+    }
+    return h->max;
+}
+
+CounterStats* initStats(BOOL read_only) {
+    // Подключает общий сегмент статистики; создает его, если нужно. 
+    // read_only — для counter_stat: только чтение и без создания
+#ifdef _WIN32
+
+    char name[NAME_SIZE];
+    shared_name("CounterStats", name, sizeof(name));
+    if (read_only) {
+        Stats_hMap = OpenFileMapping(FILE_MAP_READ, FALSE, name);
+    } else {
+        Stats_hMap = CreateFileMapping(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 
+            0, sizeof(CounterStats), name);
+    }
+    if (!Stats_hMap)
+        return NULL;
+    stats = (CounterStats*) MapViewOfFile(Stats_hMap, 
+        read_only ? FILE_MAP_READ : FILE_MAP_ALL_ACCESS, 0, 0, sizeof(CounterStats));
+    return stats;
+
+#else // POSIX
+
+    char name[NAME_SIZE];
+    int fd = shm_open(shared_name("/CounterStats", name, sizeof(name)), 
+        read_only ? O_RDONLY : (O_CREAT | O_RDWR), 0666);
+    if (fd == -1) {
+        if (!read_only)
+            perror("shm_open failed");
+        return NULL;
+    }
+    // ftruncate до того же размера безопасен, даже если сегмент уже есть
+    if (!read_only && ftruncate(fd, sizeof(CounterStats)) == -1) {
+        perror("ftruncate failed");
+        close(fd);
+        return NULL;
+    }
+
+    void* ptr = mmap(NULL, sizeof(CounterStats), 
+        read_only ? PROT_READ : (PROT_READ | PROT_WRITE), MAP_SHARED, fd, 0);
+    if (ptr == MAP_FAILED) {
+        perror("mmap failed");
+        close(fd);
+        return NULL;
+    }
+    // Отображение остается и без дескриптора, но лидер передает 
+    // его копиям (см. launch_daughter_process)
+    if (read_only) {
+        close(fd);
+    } else {
+        if (stats_fd >= 0)
+            close(stats_fd);
+        stats_fd = fd;
+    }
+    stats = (CounterStats*) ptr;
+    return stats;
+
+#endif
+}
+
+CounterStats* attach_inherited_stats(int argc, char* argv[]) {
+    // Как attach_inherited_data: сегмент статистики по дескриптору 
+    // от лидера, без shm_open и ftruncate. NULL — дескриптора нет
+#ifdef _WIN32
+
+    if (argc < 5)
+        return NULL;
+    Stats_hMap = (HANDLE) (uintptr_t) strtoull(argv[4], NULL, 10);
+    stats = (CounterStats*) MapViewOfFile(Stats_hMap, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(CounterStats));
+    if (!stats)
+        Stats_hMap = NULL;
+    return stats;
+
+#else // POSIX
+
+    if (argc < 4)
+        return NULL;
+    stats_fd = atoi(argv[3]);
+    void* ptr = mmap(NULL, sizeof(CounterStats), PROT_READ | PROT_WRITE, MAP_SHARED, stats_fd, 0);
+    if (ptr == MAP_FAILED) {
+        perror("mmap failed");
+        stats_fd = -1;
+        return NULL;
+    }
+    stats = (CounterStats*) ptr;
+    return stats;
+
+#endif
+}
+
+void cleanupStats() {
+#ifdef _WIN32
+    if (stats) {
+        UnmapViewOfFile(stats);
+        stats = NULL;
+    }
+    if (Stats_hMap) {
+        CloseHandle(Stats_hMap);
+        Stats_hMap = NULL;
+    }
+#else // POSIX
+    if (stats) {
+        munmap(stats, sizeof(CounterStats));
+        stats = NULL;
+    }
+    if (stats_fd >= 0) {
+        close(stats_fd);
+        stats_fd = -1;
+    }
+#endif
+}
+
+int stat_bucket(uint64_t ns) {
+    // Номер корзины: старший бит задает степень двойки, 
+    // следующие STAT_SUB_BITS бит — корзину внутри нее
+    if (ns < (1ULL << STAT_SUB_BITS))
+        return (int) ns;
+
+    int msb = 63;
+    while (!(ns >> msb))
+        msb--;
+    if (msb >= STAT_MAX_BITS)
+        return STAT_BUCKETS - 1;
+
+    int shift = msb - STAT_SUB_BITS;
+    int sub = (int) ((ns >> shift) & ((1ULL << STAT_SUB_BITS) - 1));
+    return ((shift + 1) << STAT_SUB_BITS) + sub;
+}
+
+uint64_t stat_bucket_upper(int bucket) {
+    // Наибольшее значение, попадающее в корзину, in ns
+    if (bucket < (1 << STAT_SUB_BITS))
+        return (uint64_t) bucket;
+
+    int shift = (bucket >> STAT_SUB_BITS) - 1;
+    uint64_t sub = (uint64_t) (bucket & ((1 << STAT_SUB_BITS) - 1));
+    uint64_t base = ((1ULL << STAT_SUB_BITS) | sub) << shift;
+    return base + (1ULL << shift) - 1;
+}
+
+void stat_record(stat_id id, uint64_t ns) {
+    // Порядок между счетчиками не важен: читатель видит 
+    // согласованную картину с точностью до нескольких записей
+    if (!stats)
+        return;
+    stat_histogram* h = &stats->hist[id];
+    atomic_fetch_add_explicit(&h->buckets[stat_bucket(ns)], 1, memory_order_relaxed);
+    if (ns == 0)
+        return;     // ни сумму, ни максимум нулевой замер не меняет
+    atomic_fetch_add_explicit(&h->total_ns, ns, memory_order_relaxed);
+
+    unsigned long long max = atomic_load_explicit(&h->max_ns, memory_order_relaxed);
+    while (ns > max && !atomic_compare_exchange_weak_explicit(&h->max_ns, &max, ns, 
+        memory_order_relaxed, memory_order_relaxed)) {}
+}
+
+void stat_count(event_id id, uint64_t n) {
+    if (stats)
+        atomic_fetch_add_explicit(&stats->events[id], n, memory_order_relaxed);
+}
+
+void stat_snapshot_take(stat_histogram* h, stat_snapshot* snap) {
+    snap->count = 0;
+    for (int i = 0; i < STAT_BUCKETS; i++) {
+        snap->buckets[i] = atomic_load_explicit(&h->buckets[i], memory_order_relaxed);
+        snap->count += snap->buckets[i];
+    }
+    snap->total_ns = atomic_load_explicit(&h->total_ns, memory_order_relaxed);
+    snap->max_ns = atomic_load_explicit(&h->max_ns, memory_order_relaxed);
+}
+
+void stat_snapshot_diff(stat_snapshot* now, stat_snapshot* before, stat_snapshot* diff) {
+    // Что добавилось между двумя снимками. Максимум за интервал 
+    // неизвестен — берется верхняя граница последней непустой корзины
+    diff->count = 0;
+    diff->max_ns = 0;
+    for (int i = 0; i < STAT_BUCKETS; i++) {
+        diff->buckets[i] = now->buckets[i] - before->buckets[i];
+        diff->count += diff->buckets[i];
+        if (diff->buckets[i])
+            diff->max_ns = stat_bucket_upper(i);
+    }
+    if (diff->max_ns > now->max_ns)
+        diff->max_ns = now->max_ns;
+    diff->total_ns = now->total_ns - before->total_ns;
+}
+
+uint64_t stat_percentile(stat_snapshot* snap, double p) {
+    // Верхняя граница корзины с p-м перцентилем, in ns
+    if (snap->count == 0)
+        return 0;
+
+    unsigned long long rank = (unsigned long long) (p / 100.0 * snap->count);
+    if (rank >= snap->count)
+        rank = snap->count - 1;
+
+    unsigned long long seen = 0;
+    for (int i = 0; i < STAT_BUCKETS; i++) {
+        seen += snap->buckets[i];
+        if (seen > rank) {
+            uint64_t bound = stat_bucket_upper(i);
+            return (bound > snap->max_ns) ? snap->max_ns : bound;
+        }
+    }
+    return snap->max_ns;
+}
+
+char* stat_name(stat_id id) {
+    switch (id) {
+        case STAT_LOCK_WAIT: return "lock_wait";
+        case STAT_LOG_WRITE: return "log_write";
+        case STAT_SPAWN: return "spawn";
+        case STAT_COPY_JOB: return "copy_job";
+        case STAT_LOOP_LATENESS: return "loop_lateness";
+        default: return "unknown";
+    }
+}
+
+void trace_init(char* role) {
+    // Трассировка включается, если задана папка TRACE_ENV
+    char* dir = getenv(TRACE_ENV);
+    if (!dir || !dir[0])
+        return;
+    trace_events = (trace_event*) malloc(TRACE_BUFFER_EVENTS * sizeof(trace_event));
+    if (!trace_events)
+        return;
+    trace_dir = dir;
+    strncpy(trace_role, role, sizeof(trace_role) - 1);
+    trace_enabled = TRUE;
+}
+
+uint32_t trace_tid() {
+#ifdef _WIN32
+    return (uint32_t) GetCurrentThreadId();
+#else // POSIX
+    return (uint32_t) syscall(SYS_gettid);
+#endif
+}
+
+void trace_span(trace_kind kind, uint64_t start_ns, uint64_t end_ns, uint64_t value) {
+    // Место в буфере выдается атомиком, дальше поток пишет в свою 
+    // запись без блокировок. Переполненный буфер только считает потери
+    if (!trace_enabled)
+        return;
+    unsigned int index = atomic_fetch_add_explicit(&trace_next, 1, memory_order_relaxed);
+    if (index >= TRACE_BUFFER_EVENTS) {
+        atomic_fetch_add_explicit(&trace_dropped, 1, memory_order_relaxed);
+        return;
+    }
+    trace_event* e = &trace_events[index];
+    e->start_ns = start_ns;
+    e->dur_ns = end_ns > start_ns ? end_ns - start_ns : 0;
+    e->value = value;
+    e->tid = trace_tid();
+    e->kind = kind;
+}
+
+void trace_flush() {
+    // Пишет буфер в TRACE_ENV/trace-PID.bin. Вызывается при выходе, 
+    // когда остальные потоки уже не пишут событий
+    if (!trace_enabled)
+        return;
+    trace_enabled = FALSE;
+
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/trace-%lu.bin", trace_dir, (unsigned long) get_current_pid());
+    FILE* f = fopen(path, "wb");
+    if (!f) {
+        perror("Couldn't open the trace file!");
+    } else {
+        trace_file_header header;
+        memset(&header, 0, sizeof(header));
+        header.magic = TRACE_MAGIC;
+        header.pid = (uint32_t) get_current_pid();
+        memcpy(header.role, trace_role, sizeof(header.role));
+        header.count = atomic_load(&trace_next);
+        if (header.count > TRACE_BUFFER_EVENTS)
+            header.count = TRACE_BUFFER_EVENTS;
+        header.dropped = atomic_load(&trace_dropped);
+        fwrite(&header, sizeof(header), 1, f);
+        fwrite(trace_events, sizeof(trace_event), (size_t) header.count, f);
+        fclose(f);
+    }
+
+    free(trace_events);
+    trace_events = NULL;
+}
+
+char* trace_kind_name(trace_kind kind) {
+    switch (kind) {
+        case TRACE_LOCK_WAIT: return "lock_wait";
+        case TRACE_LOCK_HELD: return "lock_held";
+        case TRACE_LOG_WRITE: return "log_write";
+        case TRACE_SPAWN: return "spawn";
+        case TRACE_COPY_WORK: return "copy_work";
+        case TRACE_COPY2_SLEEP: return "copy2_sleep";
+        case TRACE_LAUNCH_BUSY: return "launch_busy";
+        default: return "unknown";
+    }
+}
+
+void log_task_stats(timer_wheel* w, wheel_timer* t, char* name) {
+    char buffer[256];
+    snprintf(buffer, sizeof(buffer),
+        "%s task: %llu runs, %llu expected, %llu skipped, "
+        "lateness p50 %.3f ms, p99 %.3f ms, max %.3f ms.",
+        name, t->total_runs, wheel_expected_runs(w, t), t->skipped,
+        t->lateness ? histogram_percentile(t->lateness, 50) : 0.0,
+        t->lateness ? histogram_percentile(t->lateness, 99) : 0.0,
+        t->lateness ? t->lateness->max : 0.0);
+    log_msg(buffer);
+}
+
+
+
+void scheduler_init(copy_scheduler* s, int role, int max_in_flight, int max_queued) {
+    memset(s, 0, sizeof(*s));
+    s->role = role;
+    s->max_in_flight = max_in_flight;
+    s->max_queued = max_queued;
+    s->start_time = get_curr_time();
+}
+
+BOOL scheduler_has_slot(copy_scheduler* s) {
+    return s->in_flight_count < s->max_in_flight;
+}
+
+void scheduler_launch(copy_scheduler* s, double enqueue_time, double now) {
+    uint64_t start = get_fast_time_ns();
+    app_info* app = launch_copy(s->role);
+    if (!app)
+        return;
+    uint64_t duration = get_fast_time_ns() - start;
+    stat_record(STAT_SPAWN, duration);
+    if (trace_enabled) {
+        uint64_t end = get_curr_time_ns();
+        trace_span(TRACE_SPAWN, end - duration, end, (uint64_t) s->role);
+    }
+    COUNTER_PROBE3(copy_spawn, s->role, app->pid, duration);
+
+    copy_job* job = &s->in_flight[s->in_flight_count++];
+    job->app = app;
+    job->enqueue_time = enqueue_time;
+    job->launch_time = now;
+
+    double wait = now - enqueue_time;
+    s->total_queue_wait += wait;
+    if (wait > s->max_queue_wait) s->max_queue_wait = wait;
+    s->launched++;
+    scheduler_count(s, EVENT_COPY1_LAUNCHED, 1);
+}
+
+BOOL scheduler_submit(copy_scheduler* s, double now) {
+    // Ставит запуск копии в очередь и сразу запускает, если есть место.
+    // Возвращает FALSE, если очередь переполнена и запуск пропущен.
 
-        // Проверяем, состоит ли строка только из цифр
-        BOOL is_only_digits = TRUE;
-        for (int i = 0; trimmed[i] != '\0'; i++) {
-            if (!isdigit((unsigned char)trimmed[i])) {
-                is_only_digits = FALSE;
-                break;
-            }
-        }
+    if (scheduler_has_slot(s) && s->queue_count == 0) {
+        scheduler_launch(s, now, now);
+        return TRUE;
+    }
 
-        if (!is_only_digits) {
-            printf("Invalid input.\n");
+    if (s->queue_count >= s->max_queued) {
+        s->dropped++;
+        scheduler_count(s, EVENT_COPY1_DROPPED, 1);
+        return FALSE;
+    }
+
+    s->queue[(s->queue_head + s->queue_count) % MAX_COPY_QUEUE] = now;
+    s->queue_count++;
+    return TRUE;
+}
+
+void scheduler_poll(copy_scheduler* s, double now) {
+    // Собирает завершившиеся копии и запускает ожидающие на их место
+
+    for (int i = 0; i < s->in_flight_count; ) {
+        copy_job* job = &s->in_flight[i];
+        if (!process_is_completed(job->app)) {
+            i++;
             continue;
         }
-        else {
-            counter_t num = strtoull(trimmed, &ptr, 10);
+
+        double latency = now - job->launch_time;
+        stat_record(STAT_COPY_JOB, (uint64_t) (latency * 1e6));
+        COUNTER_PROBE3(copy_reap, s->role, job->app->pid, (uint64_t) (latency * 1e6));
+        s->total_latency += latency;
+        if (latency > s->max_latency) s->max_latency = latency;
+        s->completed++;
+        scheduler_count(s, EVENT_COPY1_COMPLETED, 1);
+
+        close_process_handle(job->app);
+        s->in_flight[i] = s->in_flight[--s->in_flight_count];
+    }
+
+    while (scheduler_has_slot(s) && s->queue_count > 0) {
+        double enqueue_time = s->queue[s->queue_head];
+        s->queue_head = (s->queue_head + 1) % MAX_COPY_QUEUE;
+        s->queue_count--;
+        scheduler_launch(s, enqueue_time, now);
+    }
+}
+
+void scheduler_cancel(copy_scheduler* s) {
+    // Отменяет ожидающие запуски (они считаются пропущенными)
+    s->dropped += s->queue_count;
+    scheduler_count(s, EVENT_COPY1_DROPPED, s->queue_count);
+    s->queue_count = 0;
+}
+
+void scheduler_count(copy_scheduler* s, event_id copy1_event, uint64_t n) {
+    // Событие EVENT_COPY1_* для копии 1, следующее за ним — для копии 2.
+    // Другие роли (role 0 в counter_bench) в общие счетчики не попадают
+    if (s->role == 1 || s->role == 2)
+        stat_count(copy1_event + s->role - 1, n);
+}
+
+int scheduler_apps(copy_scheduler* s, app_info** apps, int max) {
+    // Складывает запущенные копии в apps для wait_child_events
+    int n = 0;
+    for (int i = 0; i < s->in_flight_count && n < max; i++)
+        apps[n++] = s->in_flight[i].app;
+    return n;
+}
+
+void scheduler_drain(copy_scheduler* s) {
+    // Отменяет ожидающие запуски, просит запущенные копии 
+    // закончить раньше и дожидается их
+    s->queue_count = 0;
+
+    app_info* apps[MAX_COPY_JOBS];
+    int n = scheduler_apps(s, apps, MAX_COPY_JOBS);
+    for (int i = 0; i < n; i++)
+        stop_app(apps[i]);
+    await_apps(apps, n);
+    scheduler_poll(s, get_curr_time());
+}
+
+void log_scheduler_stats(copy_scheduler* s, double now) {
+    double elapsed = (now - s->start_time) / 1000.0;    // in s
+
+    char buffer[256];
+    snprintf(buffer, sizeof(buffer),
+        "Copy %d jobs: launched %llu, completed %llu, dropped %llu, "
+        "throughput %.3f jobs/s, latency avg %.1f ms (max %.1f ms), "
+        "queue wait avg %.1f ms (max %.1f ms).",
+        s->role, s->launched, s->completed, s->dropped,
+        elapsed > 0 ? s->completed / elapsed : 0.0,
+        s->completed ? s->total_latency / s->completed : 0.0, s->max_latency,
+        s->launched ? s->total_queue_wait / s->launched : 0.0, s->max_queue_wait);
+    log_msg(buffer);
+}
+
+
+void pacer_init(launch_pacer* p, BOOL adaptive, double min_interval, double max_interval, double now) {
+    memset(p, 0, sizeof(*p));
+    p->adaptive = adaptive;
+    p->min_interval = min_interval;
+    p->max_interval = max_interval;
+    p->last_launch = now;
+}
+
+BOOL pacer_should_launch(launch_pacer* p, double now, BOOL idle) {
+    // idle — у всех ролей есть свободное место и пустая очередь
+    double elapsed = now - p->last_launch;
+
+    if (!p->adaptive)
+        return elapsed >= config.launch_copies_delay;
+
+    if (elapsed < p->min_interval)
+        return FALSE;
+
+    // Предыдущие копии завершились — запускаем сразу, иначе 
+    // ждем их, но не дольше max_interval
+    return idle || elapsed >= p->max_interval;
+}
+
+double pacer_next_launch(launch_pacer* p, BOOL idle) {
+    // Момент, когда pacer_should_launch в следующий раз может 
+    // вернуть TRUE (если копии не завершатся раньше)
+    if (!p->adaptive)
+        return p->last_launch + config.launch_copies_delay;
+    return p->last_launch + (idle ? p->min_interval : p->max_interval);
+}
+
+void pacer_on_launch(launch_pacer* p, double now, BOOL idle) {
+    if (p->launches > 0)
+        p->total_interval += now - p->last_launch;
+    if (!idle)
+        p->forced_launches++;
+
+    p->launches++;
+    p->last_launch = now;
+    p->awaiting_completion = TRUE;
+}
+
+void pacer_on_idle(launch_pacer* p, double now) {
+    // Все запущенные копии завершились — замеряем, сколько они работали
+    if (!p->awaiting_completion)
+        return;
+    p->awaiting_completion = FALSE;
+
+    double completion = now - p->last_launch;
+    if (p->avg_completion == 0)
+        p->avg_completion = completion;
+    else
+        p->avg_completion += PACER_EWMA_WEIGHT * (completion - p->avg_completion);
+}
+
+void log_pacer_stats(launch_pacer* p) {
+    // Backpressure — доля запусков, сделанных, пока прошлые 
+    // копии еще работали (копии не успевают за темпом)
+    char buffer[256];
+    snprintf(buffer, sizeof(buffer),
+        "Launch pacing (%s): launches %llu, interval avg %.1f ms, "
+        "completion avg %.1f ms, backpressure %.1f%% (%llu launches).",
+        p->adaptive ? "adaptive" : "fixed", p->launches,
+        p->launches > 1 ? p->total_interval / (p->launches - 1) : 0.0,
+        p->avg_completion,
+        p->launches ? 100.0 * p->forced_launches / p->launches : 0.0,
+        p->forced_launches);
+    log_msg(buffer);
+}
+
+
+
+BOOL copies_idle(counter_loop* loop) {
+    // У всех ролей есть свободное место и пустая очередь
+    return scheduler_has_slot(&loop->copy_1_jobs) && loop->copy_1_jobs.queue_count == 0 &&
+        scheduler_has_slot(&loop->copy_2_jobs) && loop->copy_2_jobs.queue_count == 0;
+}
+
+void increment_task(wheel_timer* t, void* arg) {
+    // Инкрементировать счетчик (за каждый наступивший срок)
+    (void) arg;
+    lockData();
+    data->counter += t->runs;
+    unlockData();
+    notify_change();
+    stat_count(EVENT_INCREMENTS, t->runs);
+}
+
+void log_task(wheel_timer* t, void* arg) {
+    // Записать значение счетчика в лог
+    (void) t;
+    counter_loop* loop = (counter_loop*) arg;
+    if (loop->is_leader)
+        log_counter_val();
+}
+
+void launch_task(wheel_timer* t, void* arg) {
+    // Запустить копии (или пропустить запуск с сообщением, если 
+    // прошлые копии еще не завершили работу и очередь заполнена)
+    counter_loop* loop = (counter_loop*) arg;
+    double now = get_curr_time();
+    BOOL idle = copies_idle(loop);
+
+    if (loop->is_leader && pacer_should_launch(&loop->pacer, now, idle)) {
+        pacer_on_launch(&loop->pacer, now, idle);
+
+        if (!idle) {
+            // Копии встанут в очередь; в лог пишем только пропуск ниже
+            stat_count(EVENT_LAUNCH_BUSY, 1);
+            if (trace_enabled)
+                trace_span(TRACE_LAUNCH_BUSY, get_curr_time_ns(), 0, 0);
+        }
+
+        copy_scheduler* schedulers[] = { &loop->copy_1_jobs, &loop->copy_2_jobs };
+        for (int i = 0; i < 2; i++) {
+            if (!scheduler_submit(schedulers[i], now)) {
+                char msg[112];
+                snprintf(msg, sizeof(msg), "Copy %d launch dropped: previous copies "
+                    "have not completed yet and the queue is full.", schedulers[i]->role);
+                log_msg(msg);
+            }
+        }
+        idle = copies_idle(loop);
+    }
+
+    // Запуск копий нужен только лидеру
+    if (loop->is_leader)
+        wheel_add(&loop->wheel, t, pacer_next_launch(&loop->pacer, idle), 0);
+}
+
+void* hf_increment_func(void* arg) {
+    // Поток высокочастотного инкремента. За каждое пробуждение 
+    // добавляет к счетчику все инкременты, которые положены к этому 
+    // моменту, одной блокировкой — при отставании они идут пачкой.
+    hf_increment* hf = (hf_increment*) arg;
+
+    uint64_t start = get_curr_time_ns();
+    uint64_t period = (uint64_t) (1e9 / hf->rate);  // in ns
+    if (period == 0)
+        period = 1;
+    uint64_t quantum = (period > HF_SLEEP_QUANTUM) ? period : HF_SLEEP_QUANTUM;
+    uint64_t stop = (hf->duration > 0) ? start + (uint64_t) (hf->duration * 1e6) : 0;
+
+    while (!atomic_load(&quit_flag)) {
+        uint64_t now = get_curr_time_ns();
+        if (stop && now >= stop)
+            break;
+
+        // Сколько инкрементов должно быть сделано к now
+        unsigned long long due = 
+            (unsigned long long) ((double) (now - start) * hf->rate / 1e9) - hf->done;
+
+        if (due > 0) {
             lockData();
-            data->counter = num;
+            data->counter += due;
             unlockData();
-            printf("Value is set.\n");
+            notify_change();
+            stat_count(EVENT_INCREMENTS, due);
+            hf->done += due;
+            hf->batches++;
         }
+
+        if (!hf->spin) {
+            // Следующий инкремент, но не чаще HF_SLEEP_QUANTUM
+            uint64_t next = start + (uint64_t) ((double) (hf->done + 1) * 1e9 / hf->rate);
+            if (next < now + quantum)
+                next = now + quantum;
+            // Долгий сон (низкий темп) прерывается запросом на завершение
+            if (next - now > 1000000ULL && wait_shutdown((unsigned long) ((next - now) / 1000000)))
+                break;
+            sleep_until_ns(next);
+        }
+    }
+
+    hf->elapsed = (get_curr_time_ns() - start) / 1e6;
+    atomic_store(&hf->finished, TRUE);
+    return NULL;
+}
+
+void loop_init(counter_loop* loop, double now) {
+    // Планировщики копий, темп запуска и периодические задачи 
+    // экземпляра (задачу метрик регистрирует main_counter_function)
+    memset(loop, 0, sizeof(*loop));
+    scheduler_init(&loop->copy_1_jobs, 1, options.copy_concurrency, options.copy_queue_limit);
+    scheduler_init(&loop->copy_2_jobs, 2, options.copy_concurrency, options.copy_queue_limit);
+    pacer_init(&loop->pacer, options.adaptive_pacing, 
+        options.min_launch_interval, options.max_launch_interval, now);
+
+    wheel_init(&loop->wheel, now);
+    wheel_timer_init(&loop->incr_task, increment_task, loop);
+    wheel_timer_init(&loop->log_task, log_task, loop);
+    wheel_timer_init(&loop->launch_task, launch_task, loop);
+    loop->incr_task.policy = options.increment_catch_up;
+    loop->incr_task.lateness = &loop->incr_lateness;
+    loop->log_task.policy = CATCH_UP_SKIP;  // старые значения в лог писать незачем
+    loop->log_task.lateness = &loop->log_lateness;
+    if (options.hf_rate <= 0)
+        wheel_add(&loop->wheel, &loop->incr_task, now + config.increment_delay, config.increment_delay);
+    wheel_add(&loop->wheel, &loop->log_task, now + config.log_counter_delay, config.log_counter_delay);
+}
+
+void loop_elect(counter_loop* loop) {
+    // При каждом пробуждении пытаемся стать новым лидером, если старый умер
+    long current_pid = get_current_pid();
+    BOOL was_leader = loop->is_leader;
+    lockData();
+    if (data->leader_pid == -1 || !process_is_alive(data->leader_pid)) {
+        COUNTER_PROBE2(leader_change, data->leader_pid, current_pid);
+        data->leader_pid = current_pid;
+        atomic_store(&data->leader_since_ns, get_curr_time_ns());
+        stat_count(EVENT_LEADER_CHANGES, 1);
+    }
+    loop->is_leader = (current_pid == data->leader_pid);
+    unlockData();
+
+    // Лидерство забрал новый экземпляр: ожидающие в очереди копии 
+    // больше не запускаем, иначе их запускали бы два лидера сразу
+    if (was_leader && !loop->is_leader) {
+        scheduler_cancel(&loop->copy_1_jobs);
+        scheduler_cancel(&loop->copy_2_jobs);
     }
 }
 
-void copy1_function() {
-    char start_msg[] = "Copy 1 process launched.";
+void loop_run_due(counter_loop* loop, double now) {
+    // Завершившиеся копии собираются сразу, 
+    // а на их место запускаются ожидающие
+    scheduler_poll(&loop->copy_1_jobs, now);
+    scheduler_poll(&loop->copy_2_jobs, now);
+    if (loop->copy_1_jobs.in_flight_count == 0 && loop->copy_1_jobs.queue_count == 0 &&
+        loop->copy_2_jobs.in_flight_count == 0 && loop->copy_2_jobs.queue_count == 0)
+        pacer_on_idle(&loop->pacer, now);
+
+    // Срок запуска копий зависит от лидерства и от того, 
+    // завершились ли прошлые копии
+    if (loop->is_leader)
+        wheel_add(&loop->wheel, &loop->launch_task, 
+            pacer_next_launch(&loop->pacer, copies_idle(loop)), 0);
+    else
+        wheel_cancel(&loop->wheel, &loop->launch_task);
+
+    wheel_advance(&loop->wheel, now);
+}
+
+void main_counter_function() {
+    initStats(FALSE);
+    initFastClock();
+    trace_init("counter");
+    char start_msg[] = "Main process launched.";
     log_msg(start_msg);
 
+    initChildEvents();
+    initEventLoop();
     data = get_data_ptr();
     initSync();
+    initData();
+    initConfigWatch();
+    refresh_config();
+    // Ввод запускается после initData, иначе пакет команд 
+    // может успеть примениться до сброса счетчика
+    if (options.batch_path)
+        launch_daughter_thread(batch_func, options.batch_path);
+    else
+        launch_daughter_thread(terminal_func, NULL);
+
+    double now = get_curr_time();
+    double start_time = now;
+
+    // Периодические задачи живут в колесе таймеров; один timerfd 
+    // будит цикл к ближайшему сроку среди них
+    counter_loop loop;
+    loop_init(&loop, now);
+    app_info* running[2 * MAX_COPY_JOBS];
+    wheel_timer_init(&loop.metrics_task, metrics_task, &loop);
+    if (options.metrics_port > 0) {
+        loop.metrics_task.policy = CATCH_UP_SKIP;
+        wheel_add(&loop.wheel, &loop.metrics_task, now + METRICS_REFRESH, METRICS_REFRESH);
+    }
+
+    // В высокочастотном режиме инкрементом занимается отдельный поток
+    hf_increment hf;
+    memset(&hf, 0, sizeof(hf));
+    hf.rate = options.hf_rate;
+    hf.spin = options.hf_spin;
+    atomic_init(&hf.finished, TRUE);
+    if (options.hf_rate > 0) {
+        atomic_store(&hf.finished, FALSE);
+        if (!launch_daughter_thread(hf_increment_func, &hf))
+            atomic_store(&hf.finished, TRUE);
+    }
+
+    loop_timer wakeup_timer;
+    timer_init(&wakeup_timer);
+
+    // Основной цикл
+    while (!atomic_load(&quit_flag)) {
+
+        loop_elect(&loop);
+
+        // Сокет управления и метрики обслуживает только лидер
+        if (loop.is_leader) {
+            control_start();
+            metrics_start();
+        } else {
+            control_stop();
+            metrics_stop();
+        }
+        control_notify_watchers();
+
+        now = get_curr_time();
+
+        // Лидер перечитывает файл настроек, если тот поменялся
+        if (config_file_changed && loop.is_leader) {
+            config_file_changed = FALSE;
+            load_config_file();
+            char msg[] = "Configuration reloaded.";
+            log_msg(msg);
+        }
+
+        // Новые настройки (от любого экземпляра) применяем, 
+        // перерегистрируя периодические задачи с новыми периодами
+        if (refresh_config()) {
+            if (loop.incr_task.active)
+                wheel_add(&loop.wheel, &loop.incr_task, now + config.increment_delay, config.increment_delay);
+            wheel_add(&loop.wheel, &loop.log_task, now + config.log_counter_delay, config.log_counter_delay);
+        }
+
+        loop_run_due(&loop, now);
+
+        // Спим до ближайшего срока или до события
+        double deadline = wheel_next_expiry(&loop.wheel);
+        timer_arm(&wakeup_timer, deadline);
+
+        int running_count = scheduler_apps(&loop.copy_1_jobs, running, MAX_COPY_JOBS);
+        running_count += scheduler_apps(&loop.copy_2_jobs, running + running_count, MAX_COPY_JOBS);
+        wait_loop_events(running, running_count, deadline);
+    }
+    uint64_t loop_exit_ns = get_curr_time_ns();
+
+    // Сокет закрывается до передачи лидерства: иначе новый лидер 
+    // может успеть создать свой, а этот удалит его файл
+    control_stop();
+    metrics_stop();
+    lockData();
+    data->leader_pid = -1;
+    unlockData();
+
+    // Поток инкремента использует разделяемую память до самого выхода; 
+    // shutdown_fd уже разбудил его, ждать остается микросекунды
+    while (!atomic_load(&hf.finished))
+        sleep_until_ns(get_curr_time_ns() + HF_SLEEP_QUANTUM);
+#ifndef _WIN32
+    // Поток подписок после control_stop выходит за CONTROL_WATCH_POLL
+    while (atomic_load(&control_watch_running))
+        sleep_ms(1);
+#endif
+
+    scheduler_drain(&loop.copy_1_jobs);
+    scheduler_drain(&loop.copy_2_jobs);
+    now = get_curr_time();
+
+    // Задержка завершения: от запроса до выхода из основного цикла 
+    // и до конца всех копий (включая прерванную работу копий)
+    uint64_t requested = atomic_load(&shutdown_requested_ns);
+    uint64_t drained_ns = get_curr_time_ns();
+    char shutdown_msg[160];
+    snprintf(shutdown_msg, sizeof(shutdown_msg), 
+        "Shutdown latency: loop exited in %.3f ms, copies finished in %.3f ms.",
+        (loop_exit_ns - requested) / 1e6, (drained_ns - requested) / 1e6);
+    log_msg(shutdown_msg);
+    log_scheduler_stats(&loop.copy_1_jobs, now);
+    log_scheduler_stats(&loop.copy_2_jobs, now);
+    log_pacer_stats(&loop.pacer);
+    log_task_stats(&loop.wheel, &loop.incr_task, "Increment");
+    log_task_stats(&loop.wheel, &loop.log_task, "Log");
+    if (options.hf_rate > 0) {
+        char hf_msg[200];
+        snprintf(hf_msg, sizeof(hf_msg),
+            "High-frequency increment: requested %.0f/s, achieved %.0f/s, %llu batches.",
+            hf.rate, hf.elapsed > 0 ? hf.done / (hf.elapsed / 1000.0) : 0.0, hf.batches);
+        log_msg(hf_msg);
+    }
+
+    char buffer[100];
+    snprintf(buffer, sizeof(buffer), "Main loop: %llu wakeups, %.2f wakeups/s.",
+        loop_wakeups, loop_wakeups / ((now - start_time) / 1000.0));
+    log_msg(buffer);
+
+    timer_close(&wakeup_timer);
+    cleanupEventLoop();
+
+    char exit_msg[] = "Main process completed.";
+    log_msg(exit_msg);
+
+    trace_flush();
+    cleanupDataSync();
+    cleanupStats();
+
+    printf("Process terminated.\n");
+}
+
+size_t read_input(FILE* f, char* buf, size_t size) {
+    // Читает то, что уже есть во входном потоке (не дожидаясь, пока 
+    // наберется size байт), или ждет ввода. Ожидание прерывается 
+    // запросом на завершение. 0 — конец ввода или завершение
+#ifdef _WIN32
+    int n = _read(_fileno(f), buf, (unsigned int) size);
+    return (n > 0) ? (size_t) n : 0;
+#else // POSIX
+    struct pollfd pfds[2];
+    pfds[0].fd = fileno(f);
+    pfds[0].events = POLLIN;
+    pfds[1].fd = shutdown_fd;
+    pfds[1].events = POLLIN;
+    int nfds = (shutdown_fd != -1) ? 2 : 1;
+
+    while (!atomic_load(&quit_flag)) {
+        int ready = poll(pfds, nfds, -1);
+        if (ready == -1) {
+            if (errno == EINTR)
+                continue;
+            return 0;
+        }
+        if (nfds == 2 && (pfds[1].revents & POLLIN))
+            return 0;
+        if (pfds[0].revents) {
+            // POLLHUP без данных — тоже конец ввода, его вернет read
+            ssize_t n = read(pfds[0].fd, buf, size);
+            if (n >= 0)
+                return (size_t) n;
+            if (errno != EINTR && errno != EAGAIN)
+                return 0;
+        }
+    }
+    return 0;
+#endif
+}
+
+BOOL terminal_command(char* line) {
+    // Выполняет одну строку ввода. FALSE — пора завершаться
+
+    // Убираем \r от \r\n и пробелы на концах
+    line[strcspn(line, "\r")] = '\0';
+    char* trimmed = trimspaces(line);
+
+    if (trimmed[0] == '\0') {
+        // Если строка была пустой
+        printf("Terminating process...\n");
+        return FALSE;
+    }
+
+    // Проверяем, состоит ли строка только из цифр
+    for (int i = 0; trimmed[i] != '\0'; i++) {
+        if (!isdigit((unsigned char)trimmed[i])) {
+            printf("Invalid input.\n");
+            return TRUE;
+        }
+    }
+
+    char *ptr;
+    counter_t num = strtoull(trimmed, &ptr, 10);
+    lockData();
+    data->counter = num;
+    unlockData();
+    notify_change();
+    printf("Value is set.\n");
+    return TRUE;
+}
+
+void* terminal_func(void* arg) {
+    // Отдельный поток ждет ввода в командную строку и 
+    // изменяет значение счетчика при вводе. Ввод читается через 
+    // poll вместе с shutdown_fd, так что поток не висит в fgets, 
+    // когда процесс завершается по другой причине
+
+    char buffer[TERMINAL_BUFFER_SIZE];
+    size_t len = 0;
+    BOOL skip_line = FALSE;     // строка оказалась длиннее буфера
+    printf("Enter a number to change the value of the counter\n"\
+           "or leave a blank line to terminate the process.\n");
+
+    while (!atomic_load(&quit_flag)) {
+        char* nl = memchr(buffer, '\n', len);
+        if (!nl) {
+            if (len == sizeof(buffer)) {
+                // Слишком длинная строка: отбрасываем ее до конца
+                if (!skip_line)
+                    printf("Invalid input.\n");
+                skip_line = TRUE;
+                len = 0;
+            }
+            size_t n = read_input(stdin, buffer + len, sizeof(buffer) - len);
+            if (n == 0) {
+                // Конец ввода
+                request_shutdown();
+                break;
+            }
+            len += n;
+            continue;
+        }
+
+        *nl = '\0';
+        size_t line_len = nl - buffer + 1;
+        if (skip_line) {
+            skip_line = FALSE;
+        } else if (!terminal_command(buffer)) {
+            request_shutdown();
+            break;
+        }
+        len -= line_len;
+        memmove(buffer, buffer + line_len, len);
+    }
+    return NULL;
+}
+
+BOOL batch_parse_line(char* line, char* end, batch_result* r) {
+    // Строка — "set N", "add N" (N может быть отрицательным) или просто 
+    // "N" (то же, что set). Пустые строки пропускаются
+    while (line < end && isspace((unsigned char) *line))
+        line++;
+    while (end > line && isspace((unsigned char) end[-1]))
+        end--;
+    if (line == end)
+        return TRUE;
+
+    BOOL is_add = FALSE;
+    if (end - line > 4 && (strncmp(line, "set ", 4) == 0 || strncmp(line, "add ", 4) == 0)) {
+        is_add = (line[0] == 'a');
+        line += 4;
+        while (line < end && *line == ' ')
+            line++;
+    }
+
+    BOOL negative = FALSE;
+    if (is_add && line < end && *line == '-') {
+        negative = TRUE;
+        line++;
+    }
+    if (line == end)
+        return FALSE;
+
+    counter_t value = 0;
+    for (; line < end; line++) {
+        if (*line < '0' || *line > '9')
+            return FALSE;
+        value = value * 10 + (counter_t) (*line - '0');
+    }
+
+    if (is_add) {
+        r->add += negative ? (counter_t) 0 - value : value;
+    } else {
+        r->has_set = TRUE;
+        r->set_value = value;
+        r->add = 0;
+    }
+    r->commands++;
+    return TRUE;
+}
+
+void batch_parse_chunk(char* buf, size_t len, batch_result* r) {
+    // Разбирает все целые строки буфера; buf[len - 1] должен быть '\n'
+    char* end = buf + len;
+    while (buf < end) {
+        char* nl = memchr(buf, '\n', end - buf);
+        if (!batch_parse_line(buf, nl, r))
+            r->invalid++;
+        buf = nl + 1;
+    }
+}
+
+void batch_apply(batch_result* r) {
+    // Вся пачка применяется за одну блокировку
+    if (!r->has_set && r->add == 0)
+        return;
+    lockData();
+    if (r->has_set)
+        data->counter = r->set_value;
+    data->counter += r->add;
+    unlockData();
+    notify_change();
+}
+
+void* batch_func(void* arg) {
+    // Пакетный ввод: команды читаются большими кусками, каждый кусок 
+    // разбирается целиком и применяется за одну блокировку. 
+    // После файла работа продолжается с обычным вводом с терминала, 
+    // конец stdin завершает процесс, как и в terminal_func
+    char* path = (char*) arg;
+    BOOL from_stdin = strcmp(path, "-") == 0;
+    FILE* f = from_stdin ? stdin : fopen(path, "rb");
+    if (!f) {
+        perror("Batch file open failed");
+        if (from_stdin)
+            request_shutdown();
+        else
+            terminal_func(NULL);
+        return NULL;
+    }
+
+    char* buffer = (char*) malloc(BATCH_CHUNK_SIZE + 1);
+    size_t carry = 0;   // незаконченная строка с прошлого куска
+    unsigned long long commands = 0;
+    unsigned long long invalid = 0;
+    unsigned long long chunks = 0;
+    double start = get_curr_time();
+
+    while (!atomic_load(&quit_flag)) {
+        size_t n = read_input(f, buffer + carry, BATCH_CHUNK_SIZE - carry);
+        size_t len = carry + n;
+        if (n == 0) {
+            // Последняя строка без перевода строки
+            if (carry > 0) {
+                buffer[len++] = '\n';
+                carry = 0;
+            } else {
+                break;
+            }
+        }
+
+        // Разбираем до последнего перевода строки, хвост переносим
+        size_t complete = len;
+        while (complete > 0 && buffer[complete - 1] != '\n')
+            complete--;
+        if (complete == 0) {
+            if (len > BATCH_LINE_SIZE) {
+                // Перевода строки нет слишком долго — это не команда
+                invalid++;
+                len = 0;
+            }
+            carry = len;
+            continue;
+        }
+
+        batch_result r;
+        memset(&r, 0, sizeof(r));
+        batch_parse_chunk(buffer, complete, &r);
+        batch_apply(&r);
+        commands += r.commands;
+        invalid += r.invalid;
+        chunks++;
+
+        carry = len - complete;
+        memmove(buffer, buffer + complete, carry);
+    }
+
+    double elapsed = get_curr_time() - start;
+    free(buffer);
+    if (!from_stdin)
+        fclose(f);
+
+    char msg[192];
+    snprintf(msg, sizeof(msg), 
+        "Batch input: %llu commands (%llu invalid) in %.1f ms, %.0f commands/s, %llu locks.",
+        commands, invalid, elapsed, 
+        (elapsed > 0) ? commands / (elapsed / 1000.0) : 0.0, chunks);
+    log_msg(msg);
+    printf("%s\n", msg);
+
+    if (from_stdin)
+        request_shutdown();
+    else if (!atomic_load(&quit_flag))
+        terminal_func(NULL);
+    return NULL;
+}
+
+void copy1_function() {
+    uint64_t start = get_curr_time_ns();
+    char start_msg[] = "Copy 1 process launched.";
+    log_msg(start_msg);
 
     lockData();
     data->counter += 10;
     unlockData();
+    notify_change();
     // log_counter_val();
 
     char exit_msg[] = "Copy 1 process completed.";
     log_msg(exit_msg);
-
-    cleanupDataSync();
+    trace_span(TRACE_COPY_WORK, start, get_curr_time_ns(), 1);
 }
 
-void copy2_function() {
+int copy2_begin() {
+    // Копия 2 до паузы (симуляция выполняет ее части по отдельности). 
+    // Возвращает паузу в ms: настройки читаем под той же блокировкой, 
+    // лидер может менять их в любой момент (load_config_file)
     char start_msg[] = "Copy 2 process launched.";
     log_msg(start_msg);
 
-    data = get_data_ptr();
-    initSync();
-
     lockData();
     data->counter *= 2;
+    int delay = data->config.copy2_delay;
     unlockData();
+    notify_change();
     // log_counter_val();
+    return delay;
+}
 
-    sleep_ms(COPY2_DELAY);
+void copy2_end(BOOL interrupted) {
+    if (interrupted) {
+        char stop_msg[] = "Copy 2 process interrupted by shutdown.";
+        log_msg(stop_msg);
+    }
 
     lockData();
     data->counter /= 2;
     unlockData();
+    notify_change();
     // log_counter_val();
 
     char exit_msg[] = "Copy 2 process completed.";
     log_msg(exit_msg);
+}
 
-    cleanupDataSync();
+void copy2_function() {
+    uint64_t start = get_curr_time_ns();
+    int delay = copy2_begin();
+
+    // Лидер, завершаясь, прерывает ожидание; 
+    // деление все равно выполняется, чтобы вернуть значение
+    uint64_t sleep_start = get_curr_time_ns();
+    BOOL interrupted = wait_shutdown(delay);
+    trace_span(TRACE_COPY2_SLEEP, sleep_start, get_curr_time_ns(), interrupted);
+
+    copy2_end(interrupted);
+    trace_span(TRACE_COPY_WORK, start, get_curr_time_ns(), 2);
+}
+
+
+
+#ifdef COUNTER_SIM
+
+void sim_sleep_ms(unsigned long ms) {
+    sim_now_ns += (uint64_t) ms * 1000000ULL;
 }
 
+sim_process* sim_find(long pid) {
+    for (int i = 0; i < sim_process_count; i++) {
+        if (sim_processes[i].pid == pid)
+            return &sim_processes[i];
+    }
+    return NULL;
+}
+
+sim_process* sim_spawn(long parent, int role, uint64_t wake_ns) {
+    if (sim_process_count == SIM_MAX_PROCESSES)
+        return NULL;
+    sim_process* p = &sim_processes[sim_process_count++];
+    memset(p, 0, sizeof(*p));
+    p->pid = sim_next_pid++;
+    p->parent = parent;
+    p->role = role;
+    p->wake_ns = wake_ns;
+    return p;
+}
+
+void sim_exit(long pid) {
+    // Порядок оставшихся сохраняется: от него зависит порядок шагов
+    sim_process* p = sim_find(pid);
+    if (!p)
+        return;
+    int index = (int) (p - sim_processes);
+    memmove(p, p + 1, (sim_process_count - index - 1) * sizeof(sim_process));
+    sim_process_count--;
+}
+
+app_info* launch_sim_copy(int role) {
+    // Копия начнет работу через sim_spawn_ns (время fork/exec)
+    sim_process* p = sim_spawn(sim_pid, role, sim_now_ns + sim_spawn_ns);
+    if (!p)
+        return NULL;
+    app_info* info = (app_info*) malloc(sizeof(app_info));
+    memset(info, 0, sizeof(*info));
+    info->pid = (unsigned int) p->pid;
+    info->role = role;
+    return info;
+}
+
+#endif
+
+#endif // COUNTER_DECLS_ONLY
@@ -0,0 +1,1010 @@
+/*
+Замеры производительности отдельных частей счетчика.
+Запускать из папки сборки (рядом с counter и counter_daughter).
+
+    counter_bench [--json] [--scenario NAME]... [--procs N]
+    counter_bench --check [--scenario NAME]... [--tolerance PCT]
+
+Без --scenario выполняются все сценарии по порядку.
+--json печатает результаты одним JSON-документом (для сравнения
+прогонов), иначе — по строке на замер. --procs — максимум
+процессов в сценарии contention (1, 2, 4, ... до N).
+
+--check — проверка на регрессии: короткие замеры горячих путей
+сравниваются с эталонами из bench_checks. Эталоны записаны не в
+наносекундах, а в единицах калибровки (атомарная операция, простейший
+системный вызов), которые меряются тут же, поэтому от машины к машине
+они почти не меняются. Если замер больше эталона на PCT процентов
+(по умолчанию BENCH_CHECK_TOLERANCE; у шумных проверок свой допуск
+в bench_checks), код возврата 1. Эталоны сняты
+на сборке CMake по умолчанию (без оптимизации) под Linux.
+С --scenario проверяются только эти сценарии (так их запускает ctest).
+
+Роль 0 у counter_daughter ничего не делает: копия только
+подключается к разделяемой памяти и завершается, поэтому
+по ней удобно мерить стоимость запуска.
+
+Замеры меняют счетчик, пишут лог и запускают экземпляры, поэтому, 
+если COUNTER_NAMESPACE (NAMESPACE_ENV) не задан, counter_bench 
+работает в своем пространстве имен bench<PID>: отдельные /SharedData, 
+/CounterStats, лог и сокет управления в текущей папке, которые 
+удаляются при выходе. Настоящий счетчик и его counter.log не 
+меняются, даже если counter запущен рядом.
+*/
+
+#include "counter.h"
+#include "libcounter.h"
+
+#ifndef _WIN32
+    #include <sys/resource.h>
+#endif
+
+#define BENCH_LOCK_ITERATIONS 1000000
+#define BENCH_LOCK_SAMPLES 100000       // отдельно замеренных пар lock/unlock для перцентилей
+#define BENCH_LOG_LINES 20000
+#define BENCH_SPAWN_ITERATIONS 200
+#define BENCH_JOB_ITERATIONS 200
+#define BENCH_CONTENTION_DURATION 1000  // in ms, на каждое число процессов
+#define BENCH_DEFAULT_PROCS 8
+#define BENCH_IDLE_INSTANCES 100
+#define BENCH_IDLE_DURATION 5000    // in ms
+#define BENCH_WHEEL_TIMERS 100000
+#define BENCH_WHEEL_SPAN 600000     // in ms, на сколько вперед разбросаны сроки
+#define BENCH_HF_DURATION 1000      // in ms
+#define BENCH_LIB_READS 10000000
+#define BENCH_LIB_WRITES 1000000
+#define BENCH_LIB_CHANGES 200
+#define BENCH_LIB_CHANGE_DELAY 2    // in ms, пауза между изменениями
+#define BENCH_WATCHERS 200
+#define BENCH_WATCH_IDLE 1000       // in ms
+#define BENCH_CLOCK_READS 10000000
+#define BENCH_CLOCK_DRIFT 2000      // in ms, сколько сравниваем быстрые часы с CLOCK_MONOTONIC
+#define BENCH_CLOCK_STEP 100        // in ms, шаг сравнения
+#define BENCH_CAL_ATOMICS 10000000
+#define BENCH_CAL_SYSCALLS 1000000
+#define BENCH_CAL_ROUNDS 5          // калибровка — лучший из стольких прогонов
+#define BENCH_CHECK_REPEATS 3       // замер для проверки — лучший из стольких прогонов
+#define BENCH_CHECK_TOLERANCE 50    // in %, допустимое превышение эталона
+#define BENCH_LOCK_TOLERANCE 150    // in %, допуск проверки lock (см. bench_checks)
+#define BENCH_CHECK_IDLE_INSTANCES 10
+#define BENCH_CHECK_IDLE_DURATION 3000  // in ms
+
+#define BENCH_MAX_RESULTS 64
+#define BENCH_MAX_METRICS 12
+#define BENCH_MAX_SCENARIOS 16
+
+typedef struct {
+    char name[32];
+    double value;
+} bench_metric;
+
+typedef struct {
+    // Один замер: сценарий, его параметры и набор чисел
+    char scenario[32];
+    char params[64];
+    bench_metric metrics[BENCH_MAX_METRICS];
+    int metric_count;
+} bench_result;
+
+typedef struct {
+    char* name;
+    void (*func)();
+} bench_scenario;
+
+typedef enum {
+    CAL_ABSOLUTE,   // без калибровки: метрика сравнивается как есть
+    CAL_ATOMIC,     // атомарное сложение (инструкция с префиксом lock)
+    CAL_SYSCALL,    // простейший системный вызов
+    CAL_COUNT
+} bench_unit;
+
+typedef struct {
+    // Эталон для --check: метрика замера (сценарий и параметры — как 
+    // в выводе) в единицах калибровки не должна превышать baseline
+    char* scenario;
+    char* params;
+    char* metric;
+    double scale;       // in ns, сколько стоит единица метрики
+    bench_unit unit;
+    double baseline;
+    double tolerance;   // in %, 0 — общий (--tolerance)
+} bench_check;
+
+BOOL bench_json = FALSE;
+BOOL bench_private = FALSE;     // работаем в своем пространстве имен (bench_isolate)
+int bench_procs = BENCH_DEFAULT_PROCS;
+bench_result bench_results[BENCH_MAX_RESULTS];
+int bench_result_count = 0;
+bench_result* bench_current = NULL;
+
+atomic_uint_least64_t bench_change_ns = 0;   // когда писатель изменил счетчик
+atomic_int bench_watchers_woken = 0;
+atomic_uint_least64_t bench_last_wakeup_ns = 0;
+
+
+
+void bench_begin(char* scenario, char* params) {
+    // Начинает новый замер; числа добавляются через bench_metric_add
+    if (bench_result_count == BENCH_MAX_RESULTS) {
+        bench_current = NULL;
+        return;
+    }
+    bench_current = &bench_results[bench_result_count++];
+    memset(bench_current, 0, sizeof(*bench_current));
+    snprintf(bench_current->scenario, sizeof(bench_current->scenario), "%s", scenario);
+    snprintf(bench_current->params, sizeof(bench_current->params), "%s", params ? params : "");
+}
+
+void bench_metric_add(char* name, double value) {
+    // Имя метрики содержит единицу измерения: mean_ms, ops_per_s и т. п.
+    if (!bench_current || bench_current->metric_count == BENCH_MAX_METRICS)
+        return;
+    bench_metric* m = &bench_current->metrics[bench_current->metric_count++];
+    snprintf(m->name, sizeof(m->name), "%s", name);
+    m->value = value;
+}
+
+void bench_end() {
+    // В текстовом режиме замер печатается сразу
+    if (!bench_current || bench_json)
+        return;
+    printf("%s", bench_current->scenario);
+    if (bench_current->params[0])
+        printf(" (%s)", bench_current->params);
+    printf(":");
+    for (int i = 0; i < bench_current->metric_count; i++)
+        printf(" %s=%.6g", bench_current->metrics[i].name, bench_current->metrics[i].value);
+    printf("\n");
+    fflush(stdout);
+}
+
+void bench_print_json() {
+    printf("{\n  \"suite\": \"counter_bench\",\n");
+#ifdef _WIN32
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    printf("  \"cpus\": %lu,\n", (unsigned long) si.dwNumberOfProcessors);
+#else // POSIX
+    printf("  \"cpus\": %ld,\n", sysconf(_SC_NPROCESSORS_ONLN));
+#endif
+    printf("  \"results\": [");
+    for (int i = 0; i < bench_result_count; i++) {
+        bench_result* r = &bench_results[i];
+        printf("%s\n    {\"scenario\": \"%s\", \"params\": \"%s\", \"metrics\": {",
+            i ? "," : "", r->scenario, r->params);
+        for (int j = 0; j < r->metric_count; j++)
+            printf("%s\"%s\": %.9g", j ? ", " : "", r->metrics[j].name, r->metrics[j].value);
+        printf("}}");
+    }
+    printf("\n  ]\n}\n");
+}
+
+int bench_compare_doubles(const void* a, const void* b) {
+    double x = *(const double*) a, y = *(const double*) b;
+    return (x > y) - (x < y);
+}
+
+
+
+void bench_lock() {
+    // Пара lockData/unlockData без конкуренции: средняя стоимость
+    // по длинному циклу и распределение по отдельным замерам
+    uint64_t start = get_curr_time_ns();
+    for (int i = 0; i < BENCH_LOCK_ITERATIONS; i++) {
+        lockData();
+        unlockData();
+    }
+    double mean = (double) (get_curr_time_ns() - start) / BENCH_LOCK_ITERATIONS;
+
+    double* samples = (double*) malloc(BENCH_LOCK_SAMPLES * sizeof(double));
+    for (int i = 0; i < BENCH_LOCK_SAMPLES; i++) {
+        uint64_t t0 = get_fast_time_ns();
+        lockData();
+        unlockData();
+        samples[i] = (double) (get_fast_time_ns() - t0);
+    }
+    qsort(samples, BENCH_LOCK_SAMPLES, sizeof(double), bench_compare_doubles);
+
+    bench_begin("lock", "uncontended");
+    bench_metric_add("mean_ns", mean);
+    bench_metric_add("p50_ns", samples[BENCH_LOCK_SAMPLES / 2]);
+    bench_metric_add("p99_ns", samples[BENCH_LOCK_SAMPLES * 99 / 100]);
+    bench_metric_add("max_ns", samples[BENCH_LOCK_SAMPLES - 1]);
+    bench_end();
+    free(samples);
+}
+
+void bench_clock() {
+    // Стоимость чтения часов и расхождение быстрых часов 
+    // с CLOCK_MONOTONIC (get_curr_time_ns)
+    volatile uint64_t sink = 0;
+    uint64_t start = get_curr_time_ns();
+    for (int i = 0; i < BENCH_CLOCK_READS; i++)
+        sink += (uint64_t) get_curr_time();
+    double time_ms_cost = (double) (get_curr_time_ns() - start) / BENCH_CLOCK_READS;
+
+    start = get_curr_time_ns();
+    for (int i = 0; i < BENCH_CLOCK_READS; i++)
+        sink += get_curr_time_ns();
+    double time_ns_cost = (double) (get_curr_time_ns() - start) / BENCH_CLOCK_READS;
+
+    start = get_curr_time_ns();
+    for (int i = 0; i < BENCH_CLOCK_READS; i++)
+        sink += get_fast_time_ns();
+    double fast_cost = (double) (get_curr_time_ns() - start) / BENCH_CLOCK_READS;
+
+    start = get_curr_time_ns();
+    for (int i = 0; i < BENCH_CLOCK_READS; i++)
+        sink += read_tsc();
+    double tsc_cost = (double) (get_curr_time_ns() - start) / BENCH_CLOCK_READS;
+
+    // Дрейф: насколько быстрые часы уходят от CLOCK_MONOTONIC 
+    // (смещение отсчитываем от первой пары показаний)
+    uint64_t fast_start = get_fast_time_ns();
+    uint64_t mono_start = get_curr_time_ns();
+    double max_offset = 0;  // in ns
+    double offset = 0;
+    for (int elapsed = 0; elapsed < BENCH_CLOCK_DRIFT; elapsed += BENCH_CLOCK_STEP) {
+        sleep_ms(BENCH_CLOCK_STEP);
+        uint64_t fast_now = get_fast_time_ns();
+        uint64_t mono_now = get_curr_time_ns();
+        offset = (double) (fast_now - fast_start) - (double) (mono_now - mono_start);
+        if (offset < 0 ? -offset > max_offset : offset > max_offset)
+            max_offset = offset < 0 ? -offset : offset;
+    }
+
+    bench_begin("clock", fast_clock.use_tsc ? "tsc" : "monotonic");
+    bench_metric_add("get_curr_time_cost_ns", time_ms_cost);
+    bench_metric_add("get_curr_time_ns_cost_ns", time_ns_cost);
+    bench_metric_add("fast_clock_cost_ns", fast_cost);
+    bench_metric_add("read_tsc_cost_ns", tsc_cost);
+    bench_metric_add("tsc_ghz", fast_clock.use_tsc ? 1.0 / fast_clock.ns_per_tick : 0.0);
+    bench_metric_add("drift_ppm", offset / (BENCH_CLOCK_DRIFT * 1e6) * 1e6);
+    bench_metric_add("max_offset_us", max_offset / 1e3);
+    bench_end();
+}
+
+void bench_log() {
+    // log_msg целиком: время, flock, дозапись в файл
+    char msg[] = "Benchmark log line.";
+    double start = get_curr_time();
+    for (int i = 0; i < BENCH_LOG_LINES; i++)
+        log_msg(msg);
+    double elapsed = get_curr_time() - start;
+
+    bench_begin("log_msg", "");
+    bench_metric_add("lines_per_s", BENCH_LOG_LINES / (elapsed / 1000.0));
+    bench_metric_add("mean_us", elapsed * 1000.0 / BENCH_LOG_LINES);
+    bench_end();
+}
+
+void bench_daughter_startup(BOOL inherited) {
+    inherit_handles = inherited;
+
+    double total = 0, min = -1, max = 0;
+    for (int i = 0; i < BENCH_SPAWN_ITERATIONS; i++) {
+        double start = get_curr_time();
+        app_info* info = launch_daughter_process(0);
+        if (!info) {
+            fprintf(stderr, "Copy process did not open.\n");
+            return;
+        }
+        await_app(info);
+        close_process_handle(info);
+        double elapsed = get_curr_time() - start;
+
+        total += elapsed;
+        if (min < 0 || elapsed < min) min = elapsed;
+        if (elapsed > max) max = elapsed;
+    }
+
+    bench_begin("spawn", inherited ? "inherited handles" : "open by name");
+    bench_metric_add("mean_ms", total / BENCH_SPAWN_ITERATIONS);
+    bench_metric_add("min_ms", min);
+    bench_metric_add("max_ms", max);
+    bench_end();
+}
+
+void bench_spawn() {
+    bench_daughter_startup(FALSE);
+    bench_daughter_startup(TRUE);
+}
+
+void bench_copy_job_overhead(BOOL threads) {
+    // Полный цикл одной копии через планировщик: запуск,
+    // событие о завершении, сбор
+    options.thread_copies = threads;
+
+    copy_scheduler jobs;
+    scheduler_init(&jobs, 0, 1, 0);
+    app_info* running[1];
+
+    double start = get_curr_time();
+    for (int i = 0; i < BENCH_JOB_ITERATIONS; i++) {
+        scheduler_submit(&jobs, get_curr_time());
+        while (jobs.in_flight_count > 0) {
+            int n = scheduler_apps(&jobs, running, 1);
+            wait_child_events(running, n, MAIN_CYCLE_DELAY);
+            scheduler_poll(&jobs, get_curr_time());
+        }
+    }
+    double elapsed = get_curr_time() - start;
+
+    bench_begin("copy_job", threads ? "thread" : "process");
+    bench_metric_add("mean_ms", elapsed / BENCH_JOB_ITERATIONS);
+    bench_metric_add("latency_ms", jobs.completed ? jobs.total_latency / jobs.completed : 0.0);
+    bench_end();
+}
+
+void bench_copy_job() {
+    bench_copy_job_overhead(FALSE);
+    bench_copy_job_overhead(TRUE);
+}
+
+#ifndef _WIN32
+void bench_contention_worker(int start_fd, int result_fd) {
+    // Дочерний процесс: ждет общего старта и инкрементирует
+    // счетчик тем же путем, что increment_task, пока не выйдет время
+    char go;
+    read(start_fd, &go, 1);
+
+    unsigned long long done = 0;
+    double stop = get_curr_time() + BENCH_CONTENTION_DURATION;
+    while (get_curr_time() < stop) {
+        for (int i = 0; i < 64; i++) {
+            lockData();
+            data->counter++;
+            unlockData();
+            notify_change();
+        }
+        done += 64;
+    }
+    write(result_fd, &done, sizeof(done));
+    _exit(0);
+}
+
+void bench_contention_run(int procs) {
+    int start_pipe[2], result_pipe[2];
+    if (pipe(start_pipe) == -1 || pipe(result_pipe) == -1)
+        return;
+
+    lockData();
+    counter_t before = data->counter;
+    unlockData();
+
+    // Дочерние процессы наследуют отображение и семафор
+    fflush(stdout);
+    pid_t pids[64];
+    int count = 0;
+    for (int i = 0; i < procs && i < 64; i++) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            close(start_pipe[1]);
+            close(result_pipe[0]);
+            bench_contention_worker(start_pipe[0], result_pipe[1]);
+        }
+        if (pid < 0)
+            break;
+        pids[count++] = pid;
+    }
+    close(start_pipe[0]);
+    close(result_pipe[1]);
+
+    // Закрытый конец трубы будит всех сразу
+    double start = get_curr_time();
+    close(start_pipe[1]);
+
+    unsigned long long total = 0, done;
+    while (read(result_pipe[0], &done, sizeof(done)) == sizeof(done))
+        total += done;
+    double elapsed = get_curr_time() - start;
+    close(result_pipe[0]);
+    for (int i = 0; i < count; i++)
+        waitpid(pids[i], NULL, 0);
+
+    lockData();
+    counter_t after = data->counter;
+    unlockData();
+
+    char params[32];
+    snprintf(params, sizeof(params), "%d processes", count);
+    bench_begin("contention", params);
+    bench_metric_add("processes", count);
+    bench_metric_add("increments_per_s", total / (elapsed / 1000.0));
+    bench_metric_add("mean_ns", total ? elapsed * 1e6 * count / total : 0.0);
+    // Запущенный рядом counter тоже меняет значение, поэтому
+    // проверяется только, что ни один инкремент не потерян
+    bench_metric_add("lost_updates", (after - before < total) ? (double) (total - (after - before)) : 0.0);
+    bench_end();
+}
+#endif
+
+void bench_contention() {
+    // Сквозной инкремент из 1, 2, 4, ... bench_procs процессов
+#ifndef _WIN32
+    for (int procs = 1; procs <= bench_procs; procs *= 2)
+        bench_contention_run(procs);
+    if ((bench_procs & (bench_procs - 1)) != 0)
+        bench_contention_run(bench_procs);
+#endif
+}
+
+unsigned long long bench_wheel_expired = 0;
+unsigned long long bench_wheel_misses = 0;
+uint64_t bench_wheel_tick = 0;
+
+void bench_wheel_callback(wheel_timer* t, void* arg) {
+    (void) arg;
+    bench_wheel_expired++;
+    // Одноразовая задача должна сработать ровно в свой тик
+    if (!t->period && t->expires != bench_wheel_tick)
+        bench_wheel_misses++;
+}
+
+void bench_timer_wheel() {
+    // Колесо таймеров на виртуальном времени: регистрация,
+    // отмена и срабатывание большого числа задач
+    timer_wheel* wheel = (timer_wheel*) malloc(sizeof(timer_wheel));
+    wheel_timer* timers = (wheel_timer*) malloc(BENCH_WHEEL_TIMERS * sizeof(wheel_timer));
+    wheel_init(wheel, 0);
+    bench_wheel_expired = 0;
+    bench_wheel_misses = 0;
+
+    unsigned long long seed = 12345;
+    double start = get_curr_time();
+    for (int i = 0; i < BENCH_WHEEL_TIMERS; i++) {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        double deadline = 1 + (double) ((seed >> 33) % (BENCH_WHEEL_SPAN - 1));
+        // Каждая четвертая задача периодическая
+        double period = (i % 4 == 0) ? 1 + (double) ((seed >> 20) % 10000) : 0;
+        wheel_timer_init(&timers[i], bench_wheel_callback, NULL);
+        wheel_add(wheel, &timers[i], deadline, period);
+    }
+    double add_time = get_curr_time() - start;
+
+    start = get_curr_time();
+    for (int i = 1; i < BENCH_WHEEL_TIMERS; i += 2)
+        wheel_cancel(wheel, &timers[i]);
+    double cancel_time = get_curr_time() - start;
+
+    start = get_curr_time();
+    for (uint64_t tick = 0; tick <= BENCH_WHEEL_SPAN; tick++) {
+        bench_wheel_tick = tick;
+        wheel_advance(wheel, (double) tick);
+    }
+    double advance_time = get_curr_time() - start;
+
+    char params[32];
+    snprintf(params, sizeof(params), "%d timers", BENCH_WHEEL_TIMERS);
+    bench_begin("timer_wheel", params);
+    bench_metric_add("add_ns", add_time * 1e6 / BENCH_WHEEL_TIMERS);
+    bench_metric_add("cancel_ns", cancel_time * 1e6 / (BENCH_WHEEL_TIMERS / 2));
+    bench_metric_add("expire_ns", bench_wheel_expired ? advance_time * 1e6 / bench_wheel_expired : 0.0);
+    bench_metric_add("advance_ns_per_tick", advance_time * 1e6 / (BENCH_WHEEL_SPAN + 1));
+    bench_metric_add("expirations", (double) bench_wheel_expired);
+    bench_metric_add("off_tick", (double) bench_wheel_misses);
+    bench_end();
+
+    free(timers);
+    free(wheel);
+}
+
+void bench_hf_increment_run(double rate, BOOL spin) {
+    hf_increment hf;
+    memset(&hf, 0, sizeof(hf));
+    hf.rate = rate;
+    hf.spin = spin;
+    hf.duration = BENCH_HF_DURATION;
+    hf_increment_func(&hf);
+
+    double achieved = hf.done / (hf.elapsed / 1000.0);
+    char params[48];
+    snprintf(params, sizeof(params), "%s, %.0f/s", spin ? "spin" : "sleep", rate);
+    bench_begin("hf_increment", params);
+    bench_metric_add("achieved_per_s", achieved);
+    bench_metric_add("achieved_pct", 100.0 * achieved / rate);
+    bench_metric_add("batches", (double) hf.batches);
+    bench_metric_add("per_batch", hf.batches ? (double) hf.done / hf.batches : 0.0);
+    bench_end();
+}
+
+void bench_hf_increment() {
+    double hf_rates[] = { 1e3, 1e5, 1e6, 1e7 };
+    for (int i = 0; i < 4; i++) {
+        bench_hf_increment_run(hf_rates[i], FALSE);
+        bench_hf_increment_run(hf_rates[i], TRUE);
+    }
+}
+
+#ifndef _WIN32
+unsigned long long read_ctxt_switches(pid_t pid) {
+    // Переключения контекста главного потока — сколько раз он засыпал и просыпался
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/status", (int) pid);
+    FILE* f = fopen(path, "r");
+    if (!f)
+        return 0;
+
+    char line[256];
+    unsigned long long total = 0, value;
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "voluntary_ctxt_switches: %llu", &value) == 1 ||
+            sscanf(line, "nonvoluntary_ctxt_switches: %llu", &value) == 1)
+            total += value;
+    }
+    fclose(f);
+    return total;
+}
+#endif
+
+void bench_idle_run(int instances, int duration) {
+    // Запускает экземпляры counter и замеряет,
+    // сколько они просыпаются и сколько тратят процессора
+#ifndef _WIN32
+    pid_t pids[BENCH_IDLE_INSTANCES];
+    int inputs[BENCH_IDLE_INSTANCES];
+    int count = 0;
+    if (instances > BENCH_IDLE_INSTANCES)
+        instances = BENCH_IDLE_INSTANCES;
+
+    struct rusage usage_before;
+    getrusage(RUSAGE_CHILDREN, &usage_before);
+    double cpu_before = usage_before.ru_utime.tv_sec * 1e3 + usage_before.ru_utime.tv_usec / 1e3 +
+        usage_before.ru_stime.tv_sec * 1e3 + usage_before.ru_stime.tv_usec / 1e3;
+
+    fflush(stdout);
+    for (int i = 0; i < instances; i++) {
+        int fds[2];
+        if (pipe(fds) == -1)
+            break;
+
+        pid_t pid = fork();
+        if (pid == 0) {
+            dup2(fds[0], STDIN_FILENO);
+            close(fds[0]);
+            close(fds[1]);
+            int null_fd = open("/dev/null", O_WRONLY);
+            dup2(null_fd, STDOUT_FILENO);
+            char* const argv[] = {"./counter", NULL};
+            execv("./counter", argv);
+            _exit(127);
+        }
+        close(fds[0]);
+        if (pid < 0) {
+            close(fds[1]);
+            break;
+        }
+        pids[count] = pid;
+        inputs[count] = fds[1];
+        count++;
+    }
+
+    // Пропускаем запуск, затем меряем установившийся режим
+    sleep_ms(1000);
+    unsigned long long switches_before = 0, switches_after = 0;
+    for (int i = 0; i < count; i++)
+        switches_before += read_ctxt_switches(pids[i]);
+    sleep_ms(duration);
+    for (int i = 0; i < count; i++)
+        switches_after += read_ctxt_switches(pids[i]);
+
+    // Пустая строка (здесь — конец ввода) завершает экземпляры
+    for (int i = 0; i < count; i++)
+        close(inputs[i]);
+
+    for (int i = 0; i < count; i++) {
+        int status;
+        waitpid(pids[i], &status, 0);
+    }
+
+    // Процессорное время собранных потомков (с учетом прошлых сценариев)
+    struct rusage usage;
+    getrusage(RUSAGE_CHILDREN, &usage);
+    double cpu_ms = usage.ru_utime.tv_sec * 1e3 + usage.ru_utime.tv_usec / 1e3 +
+        usage.ru_stime.tv_sec * 1e3 + usage.ru_stime.tv_usec / 1e3 - cpu_before;
+
+    char params[32];
+    snprintf(params, sizeof(params), "%d instances", count);
+    bench_begin("idle_instances", params);
+    bench_metric_add("wakeups_per_s",
+        count ? (switches_after - switches_before) / (duration / 1000.0) / count : 0.0);
+    bench_metric_add("cpu_ms_per_s",
+        count ? cpu_ms / ((duration + 1000) / 1000.0) / count : 0.0);
+    bench_end();
+#endif
+}
+
+void bench_idle_instances() {
+    bench_idle_run(BENCH_IDLE_INSTANCES, BENCH_IDLE_DURATION);
+}
+
+void* bench_libcounter_writer(void* arg) {
+    // Меняет счетчик через паузы и запоминает момент изменения
+    (void) arg;
+    for (int i = 0; i < BENCH_LIB_CHANGES; i++) {
+        sleep_ms(BENCH_LIB_CHANGE_DELAY);
+        atomic_store(&bench_change_ns, get_curr_time_ns());
+        counter_add(1, NULL);
+    }
+    return NULL;
+}
+
+void bench_libcounter() {
+    // Стоимость операций libcounter и задержка counter_wait_change
+    if (counter_open() != 0) {
+        fprintf(stderr, "libcounter: counter_open failed.\n");
+        return;
+    }
+
+    volatile uint64_t sink = 0;
+    uint64_t start = get_curr_time_ns();
+    for (int i = 0; i < BENCH_LIB_READS; i++)
+        sink += counter_get();
+    double get_ns = (double) (get_curr_time_ns() - start) / BENCH_LIB_READS;
+
+    start = get_curr_time_ns();
+    for (int i = 0; i < BENCH_LIB_WRITES; i++)
+        counter_add(1, NULL);
+    double add_ns = (double) (get_curr_time_ns() - start) / BENCH_LIB_WRITES;
+
+    start = get_curr_time_ns();
+    for (int i = 0; i < BENCH_LIB_WRITES; i++)
+        counter_set(i);
+    double set_ns = (double) (get_curr_time_ns() - start) / BENCH_LIB_WRITES;
+
+    // Писатель в отдельном потоке, ждущий — здесь
+    uint64_t value = counter_get();
+    double total = 0, max = 0;
+    int seen = 0;
+    launch_daughter_thread(bench_libcounter_writer, NULL);
+    while (seen < BENCH_LIB_CHANGES && counter_wait_change(value, &value, 1000) == 1) {
+        double latency = (get_curr_time_ns() - atomic_load(&bench_change_ns)) / 1e3;
+        total += latency;
+        if (latency > max) max = latency;
+        seen++;
+    }
+
+    bench_begin("libcounter", "");
+    bench_metric_add("get_ns", get_ns);
+    bench_metric_add("add_ns", add_ns);
+    bench_metric_add("set_ns", set_ns);
+    bench_metric_add("wakeup_avg_us", seen ? total / seen : 0.0);
+    bench_metric_add("wakeup_max_us", max);
+    bench_metric_add("wakeups", seen);
+    bench_end();
+
+    counter_close();
+}
+
+void* bench_watcher(void* arg) {
+    // Ждет одного изменения счетчика
+    uint64_t last = *(uint64_t*) arg;
+    uint64_t value;
+    counter_wait_change(last, &value, -1);
+    atomic_store(&bench_last_wakeup_ns, get_curr_time_ns());
+    atomic_fetch_add(&bench_watchers_woken, 1);
+    return NULL;
+}
+
+void bench_change_watchers() {
+    // Сотни ждущих изменения: расход CPU, пока изменений нет,
+    // и за сколько просыпаются все после одного изменения
+#ifndef _WIN32
+    if (counter_open() != 0) {
+        fprintf(stderr, "libcounter: counter_open failed.\n");
+        return;
+    }
+
+    uint64_t last = counter_get();
+    atomic_store(&bench_watchers_woken, 0);
+    for (int i = 0; i < BENCH_WATCHERS; i++)
+        launch_daughter_thread(bench_watcher, &last);
+
+    struct timespec cpu_start, cpu_end;
+    sleep_ms(100);  // потоки успевают заснуть
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_start);
+    sleep_ms(BENCH_WATCH_IDLE);
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_end);
+    double idle_cpu = (cpu_end.tv_sec - cpu_start.tv_sec) * 1e3 +
+        (cpu_end.tv_nsec - cpu_start.tv_nsec) / 1e6;
+
+    uint64_t start = get_curr_time_ns();
+    counter_add(1, NULL);
+    while (atomic_load(&bench_watchers_woken) < BENCH_WATCHERS)
+        sleep_ms(1);
+    double wake_all = (atomic_load(&bench_last_wakeup_ns) - start) / 1e3;
+
+    char params[32];
+    snprintf(params, sizeof(params), "%d watchers", BENCH_WATCHERS);
+    bench_begin("change_watchers", params);
+    bench_metric_add("idle_cpu_ms_per_s", idle_cpu * 1000.0 / BENCH_WATCH_IDLE);
+    bench_metric_add("wake_all_us", wake_all);
+    bench_end();
+    counter_close();
+#endif
+}
+
+bench_scenario bench_scenarios[] = {
+    { "lock", bench_lock },
+    { "clock", bench_clock },
+    { "log_msg", bench_log },
+    { "spawn", bench_spawn },
+    { "copy_job", bench_copy_job },
+    { "contention", bench_contention },
+    { "timer_wheel", bench_timer_wheel },
+    { "libcounter", bench_libcounter },
+    { "change_watchers", bench_change_watchers },
+    { "hf_increment", bench_hf_increment },
+    { "idle_instances", bench_idle_instances },
+};
+#define BENCH_SCENARIO_COUNT ((int) (sizeof(bench_scenarios) / sizeof(bench_scenarios[0])))
+
+
+
+// Эталоны времени записаны в единицах калибровки (см. bench_unit), 
+// а число пробуждений — как есть: оно задается сроками задач, а не 
+// скоростью машины. Перед изменением эталона стоит прогнать --check 
+// несколько раз и взять типичное значение
+bench_check bench_checks[] = {
+    // lock/unlock — 4 атомарных сложения. Замер на одном ядре гуляет 
+    // до +60% (вместе с калибровкой), поэтому допуск шире общего: 
+    // предел 10 атомарных. Регрессия, ради которой проверка есть, — 
+    // системный вызов в lock/unlock — стоит больше 10 атомарных сама
+    { "lock", "uncontended", "mean_ns", 1, CAL_ATOMIC, 4, BENCH_LOCK_TOLERANCE },
+    // строка лога — 31 системный вызов
+    { "log_msg", "", "mean_us", 1e3, CAL_SYSCALL, 31, 0 },
+    // запуск копии — 5100 системных вызовов
+    { "spawn", "inherited handles", "mean_ms", 1e6, CAL_SYSCALL, 5100, 0 },
+#ifndef _WIN32
+    // простаивающий экземпляр: 5.3 пробуждения в секунду (абсолютное значение)
+    { "idle_instances", "10 instances", "wakeups_per_s", 1, CAL_ABSOLUTE, 5.3, 0 },
+    // и 5000 системных вызовов процессорного времени в секунду
+    { "idle_instances", "10 instances", "cpu_ms_per_s", 1e6, CAL_SYSCALL, 5000, 0 },
+#endif
+};
+#define BENCH_CHECK_COUNT ((int) (sizeof(bench_checks) / sizeof(bench_checks[0])))
+
+char* bench_unit_names[CAL_COUNT] = { "", "atomics", "syscalls" };
+
+void bench_calibrate(double cal[CAL_COUNT]) {
+    // Единицы калибровки в ns, лучший из BENCH_CAL_ROUNDS прогонов.
+    // Каждый раз берется минимум с прошлой калибровкой, если она была
+    cal[CAL_ABSOLUTE] = 1;
+    for (int round = 0; round < BENCH_CAL_ROUNDS; round++) {
+        atomic_uint_least64_t x = 0;
+        uint64_t start = get_curr_time_ns();
+        for (int i = 0; i < BENCH_CAL_ATOMICS; i++)
+            atomic_fetch_add(&x, 1);
+        double atomic_ns = (double) (get_curr_time_ns() - start) / BENCH_CAL_ATOMICS;
+
+#ifdef _WIN32
+        // Ожидание уже установленного события — честный вызов ядра
+        HANDLE event = CreateEvent(NULL, TRUE, TRUE, NULL);
+        start = get_curr_time_ns();
+        for (int i = 0; i < BENCH_CAL_SYSCALLS; i++)
+            WaitForSingleObject(event, 0);
+        double syscall_ns = (double) (get_curr_time_ns() - start) / BENCH_CAL_SYSCALLS;
+        CloseHandle(event);
+#else // POSIX
+        // getppid glibc не кэширует
+        start = get_curr_time_ns();
+        for (int i = 0; i < BENCH_CAL_SYSCALLS; i++)
+            getppid();
+        double syscall_ns = (double) (get_curr_time_ns() - start) / BENCH_CAL_SYSCALLS;
+#endif
+
+        if (cal[CAL_ATOMIC] <= 0 || atomic_ns < cal[CAL_ATOMIC])
+            cal[CAL_ATOMIC] = atomic_ns;
+        if (cal[CAL_SYSCALL] <= 0 || syscall_ns < cal[CAL_SYSCALL])
+            cal[CAL_SYSCALL] = syscall_ns;
+    }
+}
+
+BOOL bench_best(bench_check* c, double* best) {
+    // Лучшее (наименьшее) значение метрики среди повторов
+    BOOL found = FALSE;
+    for (int i = 0; i < bench_result_count; i++) {
+        bench_result* r = &bench_results[i];
+        if (strcmp(r->scenario, c->scenario) != 0 || strcmp(r->params, c->params) != 0)
+            continue;
+        for (int j = 0; j < r->metric_count; j++) {
+            if (strcmp(r->metrics[j].name, c->metric) != 0)
+                continue;
+            if (!found || r->metrics[j].value < *best)
+                *best = r->metrics[j].value;
+            found = TRUE;
+        }
+    }
+    return found;
+}
+
+BOOL bench_is_selected(char* scenario, bench_scenario** selected, int selected_count) {
+    // Без --scenario выбраны все
+    for (int i = 0; i < selected_count; i++) {
+        if (strcmp(selected[i]->name, scenario) == 0)
+            return TRUE;
+    }
+    return selected_count == 0;
+}
+
+int bench_run_checks(double tolerance, bench_scenario** selected, int selected_count) {
+    // Короткие замеры горячих путей против эталонов.
+    // Возвращает число проваленных проверок
+    int checked = 0;
+    for (int i = 0; i < BENCH_CHECK_COUNT; i++) {
+        if (bench_is_selected(bench_checks[i].scenario, selected, selected_count))
+            checked++;
+    }
+    if (checked == 0) {
+        printf("No checks for the selected scenarios.\n");
+        return 1;
+    }
+
+    double cal[CAL_COUNT] = { 0 };
+    bench_calibrate(cal);
+
+    for (int i = 0; i < BENCH_CHECK_REPEATS; i++) {
+        if (bench_is_selected("lock", selected, selected_count))
+            bench_lock();
+        if (bench_is_selected("log_msg", selected, selected_count))
+            bench_log();
+        if (bench_is_selected("spawn", selected, selected_count))
+            bench_daughter_startup(TRUE);
+    }
+    if (bench_is_selected("idle_instances", selected, selected_count))
+        bench_idle_run(BENCH_CHECK_IDLE_INSTANCES, BENCH_CHECK_IDLE_DURATION);
+
+    // Повторная калибровка: если машину отвлекли в начале, возьмется лучшая
+    bench_calibrate(cal);
+    printf("\nCalibration: atomic %.2f ns, syscall %.1f ns\n", cal[CAL_ATOMIC], cal[CAL_SYSCALL]);
+    printf("%-30s %12s %12s %12s %12s\n", "check", "measured", "relative", "baseline", "limit");
+
+    int failed = 0;
+    for (int i = 0; i < BENCH_CHECK_COUNT; i++) {
+        bench_check* c = &bench_checks[i];
+        if (!bench_is_selected(c->scenario, selected, selected_count))
+            continue;
+        char name[64];
+        snprintf(name, sizeof(name), "%s.%s", c->scenario, c->metric);
+        double limit = c->baseline * (1 + (c->tolerance > 0 ? c->tolerance : tolerance) / 100);
+
+        double best = 0;
+        if (!bench_best(c, &best)) {
+            printf("%-30s %12s %12s %12.4g %12.4g  FAIL (no result)\n", name, "-", "-",
+                c->baseline, limit);
+            failed++;
+            continue;
+        }
+        double relative = best * c->scale / cal[c->unit];
+        BOOL ok = relative <= limit;
+        printf("%-30s %12.4g %12.4g %12.4g %12.4g  %s", name, best, relative,
+            c->baseline, limit, ok ? "PASS" : "FAIL");
+        if (c->unit != CAL_ABSOLUTE)
+            printf(" (in %s)", bench_unit_names[c->unit]);
+        printf("\n");
+        if (!ok)
+            failed++;
+    }
+    printf("%s: %d of %d checks failed (default tolerance %.0f%%)\n", failed ? "FAIL" : "PASS",
+        failed, checked, tolerance);
+    fflush(stdout);
+    return failed;
+}
+
+void bench_isolate() {
+    // Свое пространство имен, если вызывающий не задал его сам. 
+    // Запущенные нами экземпляры и копии наследуют его вместе с окружением
+    if (getenv(NAMESPACE_ENV))
+        return;
+    char ns[32];
+#ifdef _WIN32
+    snprintf(ns, sizeof(ns), "bench%lu", (unsigned long) GetCurrentProcessId());
+    _putenv_s(NAMESPACE_ENV, ns);
+#else // POSIX
+    snprintf(ns, sizeof(ns), "bench%ld", (long) getpid());
+    setenv(NAMESPACE_ENV, ns, 1);
+#endif
+    bench_private = TRUE;
+}
+
+void bench_remove_private() {
+    // Удаляет объекты и файлы своего пространства имен
+    if (!bench_private)
+        return;
+    char name[NAME_SIZE];
+    remove(shared_name(LOG_FILE, name, sizeof(name)));
+#ifndef _WIN32
+    shm_unlink(shared_name("/SharedData", name, sizeof(name)));
+    shm_unlink(shared_name("/CounterStats", name, sizeof(name)));
+    unlink(shared_name(CONTROL_SOCKET, name, sizeof(name)));
+#endif
+}
+
+void bench_usage() {
+    fprintf(stderr, "Usage: counter_bench [--json] [--scenario NAME]... [--procs N]\n"
+        "       counter_bench --check [--scenario NAME]... [--tolerance PCT]\nScenarios:");
+    for (int i = 0; i < BENCH_SCENARIO_COUNT; i++)
+        fprintf(stderr, " %s", bench_scenarios[i].name);
+    fprintf(stderr, "\n");
+}
+
+int main(int argc, char* argv[]) {
+    bench_scenario* selected[BENCH_MAX_SCENARIOS];
+    int selected_count = 0;
+    BOOL check = FALSE;
+    double tolerance = BENCH_CHECK_TOLERANCE;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--json") == 0) {
+            bench_json = TRUE;
+        }
+        else if (strcmp(argv[i], "--check") == 0) {
+            check = TRUE;
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "--tolerance") == 0) {
+            tolerance = atof(argv[++i]);
+            if (tolerance < 0) {
+                bench_usage();
+                return 1;
+            }
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "--procs") == 0) {
+            bench_procs = atoi(argv[++i]);
+            if (bench_procs < 1 || bench_procs > 64) {
+                bench_usage();
+                return 1;
+            }
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "--scenario") == 0) {
+            i++;
+            int found = -1;
+            for (int j = 0; j < BENCH_SCENARIO_COUNT; j++) {
+                if (strcmp(argv[i], bench_scenarios[j].name) == 0)
+                    found = j;
+            }
+            if (found < 0 || selected_count == BENCH_MAX_SCENARIOS) {
+                fprintf(stderr, "Unknown scenario: %s\n", argv[i]);
+                bench_usage();
+                return 1;
+            }
+            selected[selected_count++] = &bench_scenarios[found];
+        }
+        else {
+            bench_usage();
+            return 1;
+        }
+    }
+    if (check && bench_json) {
+        // Проверка печатает свою таблицу
+        bench_usage();
+        return 1;
+    }
+    if (!check && selected_count == 0) {
+        for (int i = 0; i < BENCH_SCENARIO_COUNT; i++)
+            selected[selected_count++] = &bench_scenarios[i];
+    }
+
+    bench_isolate();
+    initChildEvents();
+    data = get_data_ptr();
+    initSync();
+    // Замеры идут по тем же путям, что и в counter, вместе со статистикой
+    initStats(FALSE);
+    initFastClock();
+
+    int failed = 0;
+    if (check) {
+        failed = bench_run_checks(tolerance, selected, selected_count);
+    } else {
+        for (int i = 0; i < selected_count; i++)
+            selected[i]->func();
+    }
+
+    if (bench_json)
+        bench_print_json();
+
+    cleanupDataSync();
+    cleanupStats();
+    bench_remove_private();
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,618 @@
+/*
+Стресс-тест отказоустойчивости: запускает несколько экземпляров
+counter и случайно убивает (SIGKILL) лидера, копии, держателей
+блокировки данных и прочие экземпляры, а также вводит значения в stdin.
+Запускать из папки сборки (рядом с counter и counter_daughter),
+когда других экземпляров counter нет.
+
+    counter_chaos [--instances K] [--duration MS] [--seed N] [--hf-rate N]
+
+Кроме того, харнесс сам порождает держателя блокировки: промежуточный 
+процесс запускает потомка, тот берет lockData и засыпает. Держателя 
+убивают, а промежуточный процесс его не собирает, так что зомби 
+остается, пока восстановление не будет измерено: он не должен 
+подвешивать блокировку.
+
+Проверяемые инварианты:
+- лидер есть всегда, кроме окна переизбрания (не дольше
+  CHAOS_FAILOVER_LIMIT), и копии запускает только он;
+- каждая копия 1, которую не убили, доходит до конца
+  (ее +10 не теряется на зависшей блокировке или при смене лидера);
+- блокировку, оставшуюся за убитым процессом (экземпляром, копией
+  или держателем-зомби), следующий получает не позже чем через
+  CHAOS_LOCK_LIMIT, а в конце она свободна;
+- за прогон удалось убить держателя блокировки, и среди них
+  был держатель-зомби (иначе проверка выше ничего не проверила).
+
+Печатает распределения времени переизбрания и восстановления
+блокировки. Код возврата 0 — нарушений нет, 1 — есть.
+Если потомки не завершились сами, добивает только их: свои экземпляры, 
+держателей и копии, чьи родители — экземпляры или харнесс.
+*/
+
+#include "counter.h"
+
+#ifndef _WIN32
+    #include <dirent.h>
+    #include <sys/prctl.h>
+#endif
+
+#define CHAOS_DEFAULT_INSTANCES 4
+#define CHAOS_DEFAULT_DURATION 30000    // in ms
+#define CHAOS_DEFAULT_HF_RATE 20000     // increments/s у каждого экземпляра (чтобы блокировка была занята чаще)
+#define CHAOS_MAX_INSTANCES 32
+#define CHAOS_ACTION_INTERVAL 500       // in ms, средняя пауза между действиями
+#define CHAOS_SAMPLE 2                  // in ms, шаг наблюдения
+#define CHAOS_SCAN_EVERY 10             // сканировать /proc раз в столько шагов
+#define CHAOS_SETTLE 1000               // in ms, пауза после запуска экземпляров
+#define CHAOS_FAILOVER_LIMIT 2000       // in ms, дольше без лидера — нарушение
+#define CHAOS_LOCK_LIMIT 1000           // in ms, дольше блокировка за убитым — нарушение
+#define CHAOS_SPLIT_GRACE 100           // in ms, столько копии еще может запускать бывший лидер
+#define CHAOS_HOLDER_SPIN 50            // in ms, сколько ловим держателя блокировки
+#define CHAOS_ZOMBIE_HOLD_WAIT 1000     // in ms, сколько ждем, пока свой держатель возьмет блокировку
+#define CHAOS_EXIT_TIMEOUT 10000        // in ms, ожидание завершения в конце
+#define CHAOS_MAX_SAMPLES 4096
+#define CHAOS_MAX_PIDS 8192
+
+typedef struct {
+    pid_t pid;          // 0 — слот пуст (экземпляр убит и еще не перезапущен)
+    int input_fd;       // stdin экземпляра
+    double last_leader; // in ms, когда последний раз был лидером (0 — не был)
+} chaos_instance;
+
+typedef struct {
+    double values[CHAOS_MAX_SAMPLES];
+    int count;
+} chaos_samples;
+
+chaos_instance instances[CHAOS_MAX_INSTANCES];
+int instance_count = CHAOS_DEFAULT_INSTANCES;
+double hf_rate = CHAOS_DEFAULT_HF_RATE;
+
+pid_t seen_daughters[CHAOS_MAX_PIDS];
+int seen_daughter_count = 0;
+pid_t killed_daughters[CHAOS_MAX_PIDS];
+int killed_daughter_count = 0;
+
+chaos_samples failover_times;       // in ms
+chaos_samples lock_recovery_times;  // in ms
+int violations = 0;
+double run_start = 0;
+
+// Действия
+int leader_kills = 0, follower_kills = 0, copy_kills = 0;
+int holder_attempts = 0, holder_kills = 0, zombie_holder_kills = 0, sets_injected = 0;
+
+
+
+void violation(char* what, long pid) {
+    printf("[%8.1f ms] VIOLATION: %s (PID %ld)\n", get_curr_time() - run_start, what, pid);
+    violations++;
+}
+
+void sample_add(chaos_samples* s, double value) {
+    if (s->count < CHAOS_MAX_SAMPLES)
+        s->values[s->count++] = value;
+}
+
+int compare_doubles(const void* a, const void* b) {
+    double x = *(const double*) a, y = *(const double*) b;
+    return (x > y) - (x < y);
+}
+
+void print_samples(char* name, chaos_samples* s) {
+    if (s->count == 0) {
+        printf("%-14s no samples\n", name);
+        return;
+    }
+    qsort(s->values, s->count, sizeof(double), compare_doubles);
+    printf("%-14s n=%d p50=%.1f ms p90=%.1f ms p99=%.1f ms max=%.1f ms\n", name, s->count,
+        s->values[s->count / 2], s->values[s->count * 90 / 100],
+        s->values[s->count * 99 / 100], s->values[s->count - 1]);
+}
+
+BOOL pid_in(pid_t* pids, int count, pid_t pid) {
+    for (int i = 0; i < count; i++) {
+        if (pids[i] == pid)
+            return TRUE;
+    }
+    return FALSE;
+}
+
+chaos_instance* find_instance(pid_t pid) {
+    for (int i = 0; i < instance_count; i++) {
+        if (instances[i].pid != 0 && instances[i].pid == pid)
+            return &instances[i];
+    }
+    return NULL;
+}
+
+#ifndef _WIN32
+
+void start_instance(chaos_instance* inst) {
+    int fds[2];
+    if (pipe(fds) == -1) {
+        perror("pipe failed");
+        return;
+    }
+
+    char rate_str[32];
+    snprintf(rate_str, sizeof(rate_str), "%.0f", hf_rate);
+    pid_t pid = fork();
+    if (pid == 0) {
+        dup2(fds[0], STDIN_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        int null_fd = open("/dev/null", O_WRONLY);
+        dup2(null_fd, STDOUT_FILENO);
+        // Адаптивный темп: копии запускаются чаще, чем раз в 3 с
+        char* argv[] = {"./counter", "--pacing", "adaptive", "--min-interval", "200",
+            "--max-interval", "1000", NULL, NULL, NULL};
+        if (hf_rate > 0) {
+            argv[7] = "--hf-rate";
+            argv[8] = rate_str;
+        }
+        execv("./counter", argv);
+        _exit(127);
+    }
+    close(fds[0]);
+    if (pid < 0) {
+        close(fds[1]);
+        return;
+    }
+    inst->pid = pid;
+    inst->input_fd = fds[1];
+    inst->last_leader = 0;
+}
+
+void kill_instance(chaos_instance* inst) {
+    // Сразу собираем процесс, чтобы kill(pid, 0) у остальных
+    // экземпляров не видел зомби живым
+    kill(inst->pid, SIGKILL);
+    waitpid(inst->pid, NULL, 0);
+    close(inst->input_fd);
+    inst->pid = 0;
+}
+
+int scan_daughters(pid_t* pids, pid_t* parents, int max) {
+    // Ищет в /proc процессы counter_daughter
+    DIR* d = opendir("/proc");
+    if (!d)
+        return 0;
+    int count = 0;
+    struct dirent* entry;
+    while ((entry = readdir(d)) != NULL && count < max) {
+        if (!isdigit((unsigned char) entry->d_name[0]))
+            continue;
+        char path[sizeof(entry->d_name) + 16];  // "/proc/" + имя + "/stat"
+        snprintf(path, sizeof(path), "/proc/%s/stat", entry->d_name);
+        FILE* f = fopen(path, "r");
+        if (!f)
+            continue;
+        char line[512];
+        BOOL ok = fgets(line, sizeof(line), f) != NULL;
+        fclose(f);
+        if (!ok)
+            continue;
+
+        // Формат: pid (comm) state ppid ...; comm обрезан до 15 символов
+        char* comm_end = strrchr(line, ')');
+        char state;
+        int ppid;
+        if (!comm_end || !strstr(line, "(counter_daughte") ||
+            sscanf(comm_end + 1, " %c %d", &state, &ppid) != 2 || state == 'Z')
+            continue;
+        pids[count] = (pid_t) atoi(entry->d_name);
+        parents[count] = (pid_t) ppid;
+        count++;
+    }
+    closedir(d);
+    return count;
+}
+
+pid_t start_zombie_holder(pid_t* holder) {
+    // Промежуточный процесс запускает держателя и не собирает его: 
+    // убитый держатель остается зомби. Держатель — форк харнесса, 
+    // /SharedData у него уже отображена
+    int fds[2];
+    if (pipe(fds) == -1)
+        return -1;
+    pid_t parent = fork();
+    if (parent == 0) {
+        close(fds[0]);
+        pid_t pid = fork();
+        if (pid == 0) {
+            close(fds[1]);
+            lockData();
+            for (;;)
+                pause();
+        }
+        write(fds[1], &pid, sizeof(pid));
+        close(fds[1]);
+        for (;;)
+            pause();
+    }
+    close(fds[1]);
+    *holder = -1;
+    if (parent > 0 && read(fds[0], holder, sizeof(*holder)) != sizeof(*holder))
+        *holder = -1;
+    close(fds[0]);
+    return parent;
+}
+
+void kill_leftovers() {
+    // Добивает только своих: экземпляры и копии, чьи родители — 
+    // экземпляры или харнесс (осиротевшие копии достаются нам)
+    for (int i = 0; i < instance_count; i++) {
+        if (instances[i].pid != 0)
+            kill(instances[i].pid, SIGKILL);
+    }
+    pid_t pids[256], parents[256];
+    int count = scan_daughters(pids, parents, 256);
+    for (int i = 0; i < count; i++) {
+        if (parents[i] == getpid() || find_instance(parents[i]))
+            kill(pids[i], SIGKILL);
+    }
+}
+
+void reap_children() {
+    // Собирает осиротевшие копии (харнесс — subreaper) и замечает
+    // экземпляры, завершившиеся сами
+    pid_t pid;
+    while ((pid = waitpid(-1, NULL, WNOHANG)) > 0) {
+        chaos_instance* inst = find_instance(pid);
+        if (inst) {
+            violation("instance exited on its own", pid);
+            close(inst->input_fd);
+            inst->pid = 0;
+        }
+    }
+}
+
+void check_copy1_ledger(long log_offset, int* launched, int* completed, int* lost) {
+    // Каждая копия 1 из лога, которую не убивали, должна завершиться
+    *launched = *completed = *lost = 0;
+    char log_name[NAME_SIZE];
+    FILE* f = fopen(shared_name(LOG_FILE, log_name, sizeof(log_name)), "r");
+    if (!f)
+        return;
+    fseek(f, log_offset, SEEK_SET);
+
+    static pid_t started[CHAOS_MAX_PIDS];
+    static pid_t finished[CHAOS_MAX_PIDS];
+    int started_count = 0, finished_count = 0;
+    char line[512];
+    while (fgets(line, sizeof(line), f)) {
+        char* pid_str = strstr(line, "(PID: ");
+        if (!pid_str)
+            continue;
+        pid_t pid = (pid_t) atol(pid_str + 6);
+        if (strstr(line, "MSG: Copy 1 process launched.") && started_count < CHAOS_MAX_PIDS)
+            started[started_count++] = pid;
+        else if (strstr(line, "MSG: Copy 1 process completed.") && finished_count < CHAOS_MAX_PIDS)
+            finished[finished_count++] = pid;
+    }
+    fclose(f);
+
+    *launched = started_count;
+    *completed = finished_count;
+    for (int i = 0; i < started_count; i++) {
+        if (!pid_in(finished, finished_count, started[i]) &&
+            !pid_in(killed_daughters, killed_daughter_count, started[i])) {
+            violation("copy 1 never completed", started[i]);
+            (*lost)++;
+        }
+    }
+}
+
+#endif
+
+int main(int argc, char* argv[]) {
+    double duration = CHAOS_DEFAULT_DURATION;
+    unsigned int seed = (unsigned int) time(NULL);
+
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 < argc && strcmp(argv[i], "--instances") == 0) {
+            instance_count = atoi(argv[++i]);
+        } else if (i + 1 < argc && strcmp(argv[i], "--duration") == 0) {
+            duration = atof(argv[++i]);
+        } else if (i + 1 < argc && strcmp(argv[i], "--seed") == 0) {
+            seed = (unsigned int) strtoul(argv[++i], NULL, 10);
+        } else if (i + 1 < argc && strcmp(argv[i], "--hf-rate") == 0) {
+            hf_rate = atof(argv[++i]);
+        } else {
+            instance_count = 0;
+            break;
+        }
+    }
+    if (instance_count < 2 || instance_count > CHAOS_MAX_INSTANCES || duration <= 0 || hf_rate < 0) {
+        printf("Usage: counter_chaos [--instances K] [--duration MS] [--seed N] [--hf-rate N]\n");
+        return 1;
+    }
+
+#ifdef _WIN32
+    printf("counter_chaos is not supported on Windows.\n");
+    return 1;
+#else
+
+    srand(seed);
+    printf("Chaos run: %d instances, %.0f ms, seed %u.\n", instance_count, duration, seed);
+    fflush(stdout);
+
+    // Запись в stdin убитого экземпляра не должна убивать харнесс,
+    // а копии убитых лидеров должны доставаться нам, а не init
+    signal(SIGPIPE, SIG_IGN);
+    prctl(PR_SET_CHILD_SUBREAPER, 1);
+
+    data = get_data_ptr();
+    initSync();
+
+    // Разбираем только строки лога, записанные за этот прогон
+    long log_offset = 0;
+    char log_name[NAME_SIZE];
+    FILE* log = fopen(shared_name(LOG_FILE, log_name, sizeof(log_name)), "a");
+    if (log) {
+        fseek(log, 0, SEEK_END);
+        log_offset = ftell(log);
+        fclose(log);
+    }
+
+    for (int i = 0; i < instance_count; i++)
+        start_instance(&instances[i]);
+    sleep_ms(CHAOS_SETTLE);
+
+    run_start = get_curr_time();
+    double stop = run_start + duration;
+    double next_action = run_start + rand() % (2 * CHAOS_ACTION_INTERVAL);
+    double leaderless_since = 0;
+    BOOL leaderless_reported = FALSE;
+    pid_t failover_from = 0;        // убитый лидер, чья замена еще не выбрана
+    double failover_start = 0;
+    pid_t dead_holder = 0;          // убитый держатель блокировки
+    pid_t zombie_parent = 0;        // промежуточный процесс держателя-зомби
+    double holder_kill_time = 0;
+    int step = 0;
+
+    while (get_curr_time() < stop) {
+        sleep_ms(CHAOS_SAMPLE);
+        reap_children();
+        double now = get_curr_time();
+
+        // Лидер: живой экземпляр из наших
+        long leader = atomic_load((_Atomic long*) &data->leader_pid);
+        chaos_instance* leader_inst = find_instance((pid_t) leader);
+        if (leader_inst) {
+            leader_inst->last_leader = now;
+            leaderless_since = 0;
+            leaderless_reported = FALSE;
+            if (failover_from && leader != failover_from) {
+                sample_add(&failover_times, now - failover_start);
+                failover_from = 0;
+            }
+        } else {
+            if (leaderless_since == 0)
+                leaderless_since = now;
+            if (!leaderless_reported && now - leaderless_since > CHAOS_FAILOVER_LIMIT) {
+                violation("no leader for too long", leader);
+                leaderless_reported = TRUE;
+            }
+        }
+
+        // Блокировку убитого держателя должен получить следующий: 
+        // он перезаписывает lock_owner (экземпляры берут ее постоянно)
+        if (dead_holder) {
+            long owner = atomic_load(&data->lock_owner);
+            BOOL done = FALSE;
+            if (owner != dead_holder) {
+                sample_add(&lock_recovery_times, now - holder_kill_time);
+                done = TRUE;
+            } else if (now - holder_kill_time > CHAOS_LOCK_LIMIT) {
+                violation("lock still held by a killed process", dead_holder);
+                done = TRUE;
+            }
+            if (done) {
+                dead_holder = 0;
+                if (zombie_parent > 0) {
+                    // Зомби больше не нужен: промежуточный процесс 
+                    // собираем, держателя соберет reap_children
+                    kill(zombie_parent, SIGKILL);
+                    waitpid(zombie_parent, NULL, 0);
+                    zombie_parent = 0;
+                }
+            }
+        }
+
+        // Новые копии должен запускать только лидер
+        if (++step % CHAOS_SCAN_EVERY == 0) {
+            pid_t pids[256], parents[256];
+            int count = scan_daughters(pids, parents, 256);
+            for (int i = 0; i < count; i++) {
+                if (pid_in(seen_daughters, seen_daughter_count, pids[i]))
+                    continue;
+                if (seen_daughter_count < CHAOS_MAX_PIDS)
+                    seen_daughters[seen_daughter_count++] = pids[i];
+                chaos_instance* parent = find_instance(parents[i]);
+                if (parent && (parent->last_leader == 0 ||
+                    now - parent->last_leader > CHAOS_SPLIT_GRACE + CHAOS_SCAN_EVERY * CHAOS_SAMPLE))
+                    violation("copy launched by a non-leader", parents[i]);
+            }
+        }
+
+        // Убитые экземпляры перезапускаем после выбора нового лидера:
+        // новый экземпляр забирает лидерство сразу и скрыл бы переизбрание
+        if (!failover_from) {
+            for (int i = 0; i < instance_count; i++) {
+                if (instances[i].pid == 0)
+                    start_instance(&instances[i]);
+            }
+        }
+
+        if (now < next_action)
+            continue;
+        next_action = now + rand() % (2 * CHAOS_ACTION_INTERVAL);
+
+        int action = rand() % 100;
+        if (action < 25) {
+            // Убить лидера
+            if (leader_inst && !failover_from) {
+                failover_from = leader_inst->pid;
+                failover_start = get_curr_time();
+                kill_instance(leader_inst);
+                leader_kills++;
+            }
+        } else if (action < 35) {
+            // Убить не лидера
+            chaos_instance* inst = &instances[rand() % instance_count];
+            if (inst->pid != 0 && inst != leader_inst) {
+                kill_instance(inst);
+                follower_kills++;
+            }
+        } else if (action < 60) {
+            // Убить копию
+            pid_t pids[256], parents[256];
+            int count = scan_daughters(pids, parents, 256);
+            if (count > 0) {
+                int pick = rand() % count;
+                kill(pids[pick], SIGKILL);
+                if (killed_daughter_count < CHAOS_MAX_PIDS)
+                    killed_daughters[killed_daughter_count++] = pids[pick];
+                copy_kills++;
+            }
+        } else if (action < 70) {
+            // Убить того, кто держит блокировку
+            if (dead_holder || failover_from)
+                continue;
+            holder_attempts++;
+            double spin_until = get_curr_time() + CHAOS_HOLDER_SPIN;
+            while (get_curr_time() < spin_until) {
+                long owner = atomic_load(&data->lock_owner);
+                if (owner <= 0 || owner == (long) getpid()) {
+                    sched_yield();  // на одном ядре держатель иначе не успеет взять блокировку
+                    continue;
+                }
+                chaos_instance* inst = find_instance((pid_t) owner);
+                holder_kill_time = get_curr_time();
+                if (inst) {
+                    if (inst == leader_inst) {
+                        failover_from = inst->pid;
+                        failover_start = holder_kill_time;
+                        leader_kills++;
+                    }
+                    kill_instance(inst);
+                } else {
+                    kill((pid_t) owner, SIGKILL);
+                    if (killed_daughter_count < CHAOS_MAX_PIDS)
+                        killed_daughters[killed_daughter_count++] = (pid_t) owner;
+                }
+                dead_holder = (pid_t) owner;
+                holder_kills++;
+                break;
+            }
+        } else if (action < 80) {
+            // Свой держатель, который после SIGKILL остается зомби
+            if (dead_holder || failover_from)
+                continue;
+            holder_attempts++;
+            pid_t holder;
+            pid_t parent = start_zombie_holder(&holder);
+            if (parent <= 0)
+                continue;
+            double wait_until = get_curr_time() + CHAOS_ZOMBIE_HOLD_WAIT;
+            while (holder > 0 && atomic_load(&data->lock_owner) != (long) holder &&
+                get_curr_time() < wait_until)
+                sched_yield();
+            if (holder > 0 && atomic_load(&data->lock_owner) == (long) holder) {
+                holder_kill_time = get_curr_time();
+                kill(holder, SIGKILL);
+                dead_holder = holder;
+                zombie_parent = parent;
+                holder_kills++;
+                zombie_holder_kills++;
+            } else {
+                // Не дождались: держателя осиротит промежуточный процесс, 
+                // и его, как и прочих сирот, соберет reap_children
+                if (holder > 0)
+                    kill(holder, SIGKILL);
+                kill(parent, SIGKILL);
+                waitpid(parent, NULL, 0);
+            }
+        } else {
+            // Ввести значение в stdin случайного экземпляра
+            chaos_instance* inst = &instances[rand() % instance_count];
+            if (inst->pid != 0) {
+                char line[32];
+                int len = snprintf(line, sizeof(line), "%d\n", rand() % 1000000);
+                if (write(inst->input_fd, line, len) == len)
+                    sets_injected++;
+            }
+        }
+    }
+
+    // Завершение: пустая строка в stdin, затем ждем всех потомков
+    // (в том числе осиротевшие копии и держателя-зомби)
+    if (zombie_parent > 0)
+        kill(zombie_parent, SIGKILL);
+    for (int i = 0; i < instance_count; i++) {
+        if (instances[i].pid != 0) {
+            write(instances[i].input_fd, "\n", 1);
+            close(instances[i].input_fd);
+        }
+    }
+    double exit_deadline = get_curr_time() + CHAOS_EXIT_TIMEOUT;
+    BOOL leftovers_killed = FALSE;
+    for (;;) {
+        pid_t pid = waitpid(-1, NULL, WNOHANG);
+        if (pid == -1)
+            break;  // ECHILD — потомков не осталось
+        if (pid > 0) {
+            chaos_instance* inst = find_instance(pid);
+            if (inst)
+                inst->pid = 0;
+            continue;
+        }
+        if (get_curr_time() > exit_deadline) {
+            // Не должно случаться; добиваем своих и ждем дальше
+            if (!leftovers_killed)
+                violation("processes still running at the end", 0);
+            leftovers_killed = TRUE;
+            kill_leftovers();
+        }
+        sleep_ms(10);
+    }
+
+    // В конце блокировка должна быть свободна. Ее может держать только 
+    // убитый последним (EOWNERDEAD): такую отпускаем, это не нарушение
+    int rc = pthread_mutex_trylock(&data->lock);
+    if (rc == EOWNERDEAD)
+        rc = pthread_mutex_consistent(&data->lock);
+    if (rc == 0) {
+        atomic_store(&data->lock_owner, 0);
+        pthread_mutex_unlock(&data->lock);
+    } else {
+        violation("lock not free at the end", atomic_load(&data->lock_owner));
+    }
+
+    int launched, completed, lost;
+    check_copy1_ledger(log_offset, &launched, &completed, &lost);
+
+    // Без убитых держателей восстановление блокировки не проверено
+    if (holder_kills == 0)
+        violation("no lock holder was killed", 0);
+    else if (zombie_holder_kills == 0)
+        violation("no zombie lock holder was killed", 0);
+
+    printf("Actions: %d leader kills, %d follower kills, %d copy kills, "
+        "%d lock-holder kills (%d of them zombies, %d attempts), %d sets injected.\n",
+        leader_kills, follower_kills, copy_kills, holder_kills, zombie_holder_kills, 
+        holder_attempts, sets_injected);
+    print_samples("failover", &failover_times);
+    print_samples("lock recovery", &lock_recovery_times);
+    printf("Copy 1: %d launched, %d completed, %d killed by the harness, %d lost.\n",
+        launched, completed, killed_daughter_count, lost);
+    printf("%s: %d violations.\n", violations ? "FAIL" : "PASS", violations);
+
+    cleanupDataSync();
+    return violations ? 1 : 0;
+
+#endif
+}
@@ -0,0 +1,224 @@
+/*
+Клиент сокета управления лидера (CONTROL_SOCKET).
+Запускать из папки, в которой работает counter.
+
+    counter_client get
+    counter_client set N
+    counter_client add N          (N может быть отрицательным)
+    counter_client watch          печатает каждое новое значение
+    counter_client bench [CLIENTS] [OPS] [DEPTH]
+        нагрузочный тест: CLIENTS соединений, у каждого до DEPTH 
+        запросов в полете, всего OPS операций ADD/GET
+*/
+
+#include "counter.h"
+
+#define BENCH_DEFAULT_CLIENTS 8
+#define BENCH_DEFAULT_OPS 1000000
+#define BENCH_DEFAULT_DEPTH 64
+
+int control_connect() {
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        perror("socket failed");
+        return -1;
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    char path[NAME_SIZE];
+    strncpy(addr.sun_path, shared_name(CONTROL_SOCKET, path, sizeof(path)), sizeof(addr.sun_path) - 1);
+
+    if (connect(fd, (struct sockaddr*) &addr, sizeof(addr)) == -1) {
+        perror("connect failed");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+typedef struct {
+    int fd;
+    long long sent;
+    long long received;
+    size_t partial_len;     // байт неполного ответа в прошлом чтении
+} bench_client;
+
+BOOL write_all(int fd, unsigned char* buf, size_t len) {
+    // Сокеты нагрузочного теста неблокирующие: при заполненном 
+    // буфере ждем, пока сервер разберет запросы
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            struct pollfd pfd = { .fd = fd, .events = POLLOUT };
+            if (poll(&pfd, 1, 1000) <= 0)
+                return FALSE;
+            continue;
+        }
+        if (n <= 0)
+            return FALSE;
+        buf += n;
+        len -= (size_t) n;
+    }
+    return TRUE;
+}
+
+BOOL read_all(int fd, unsigned char* buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = read(fd, buf, len);
+        if (n <= 0)
+            return FALSE;
+        buf += n;
+        len -= (size_t) n;
+    }
+    return TRUE;
+}
+
+int run_command(unsigned char op, uint64_t value) {
+    int fd = control_connect();
+    if (fd == -1)
+        return 1;
+
+    unsigned char msg[CONTROL_MSG_SIZE];
+    msg[0] = op;
+    put_u64(msg + 1, value);
+    if (!write_all(fd, msg, sizeof(msg))) {
+        printf("Request failed.\n");
+        close(fd);
+        return 1;
+    }
+
+    // Для WATCH первый ответ — текущее значение, дальше уведомления
+    while (read_all(fd, msg, sizeof(msg))) {
+        if (msg[0] == CONTROL_ERROR) {
+            printf("Request failed.\n");
+            close(fd);
+            return 1;
+        }
+        printf("%llu\n", (unsigned long long) get_u64(msg + 1));
+        fflush(stdout);
+        if (op != CONTROL_WATCH)
+            break;
+    }
+
+    close(fd);
+    return 0;
+}
+
+int bench_exchange(bench_client* c, struct pollfd* pfds, int clients, long long per_client, int depth) {
+    // Гоняет запросы по уже открытым соединениям до конца теста
+    unsigned char buffer[CONTROL_MSG_SIZE * 1024];
+    double start = get_curr_time();
+    long long done = 0;
+
+    while (done < per_client * clients) {
+        for (int i = 0; i < clients; i++) {
+            // Досылаем запросы, пока в полете меньше depth
+            int batch = 0;
+            while (c[i].sent < per_client && c[i].sent - c[i].received < depth && 
+                   batch < (int) (sizeof(buffer) / CONTROL_MSG_SIZE)) {
+                unsigned char* msg = buffer + batch * CONTROL_MSG_SIZE;
+                msg[0] = (c[i].sent % 2) ? CONTROL_GET : CONTROL_ADD;
+                put_u64(msg + 1, 1);
+                c[i].sent++;
+                batch++;
+            }
+            if (batch > 0 && !write_all(c[i].fd, buffer, batch * CONTROL_MSG_SIZE)) {
+                printf("Request failed.\n");
+                return 1;
+            }
+
+            pfds[i].fd = c[i].fd;
+            pfds[i].events = (c[i].received < c[i].sent) ? POLLIN : 0;
+        }
+
+        if (poll(pfds, clients, 1000) <= 0) {
+            printf("Server does not respond.\n");
+            return 1;
+        }
+
+        for (int i = 0; i < clients; i++) {
+            if (!(pfds[i].revents & POLLIN))
+                continue;
+            ssize_t n = read(c[i].fd, buffer, sizeof(buffer));
+            if (n == -1 && (errno == EAGAIN || errno == EINTR))
+                continue;
+            if (n <= 0) {
+                printf("Connection closed.\n");
+                return 1;
+            }
+            // Ответ может прийти по частям — считаем целые
+            size_t total = c[i].partial_len + (size_t) n;
+            c[i].received += total / CONTROL_MSG_SIZE;
+            done += total / CONTROL_MSG_SIZE;
+            c[i].partial_len = total % CONTROL_MSG_SIZE;
+        }
+    }
+
+    double elapsed = get_curr_time() - start;
+    printf("control_bench (%d clients, depth %d): %lld ops in %.1f ms, %.0f ops/s, "
+        "latency avg %.3f ms\n",
+        clients, depth, done, elapsed, done / (elapsed / 1000.0),
+        elapsed * clients * depth / done);
+    return 0;
+}
+
+int run_bench(int clients, long long ops, int depth) {
+    bench_client* c = (bench_client*) calloc(clients, sizeof(bench_client));
+    struct pollfd* pfds = (struct pollfd*) calloc(clients, sizeof(struct pollfd));
+    if (!c || !pfds) {
+        free(c);
+        free(pfds);
+        return 1;
+    }
+    for (int i = 0; i < clients; i++)
+        c[i].fd = -1;
+
+    int result = 0;
+    for (int i = 0; i < clients; i++) {
+        c[i].fd = control_connect();
+        if (c[i].fd == -1) {
+            result = 1;
+            break;
+        }
+        fcntl(c[i].fd, F_SETFL, O_NONBLOCK);
+    }
+    if (result == 0)
+        result = bench_exchange(c, pfds, clients, ops / clients, depth);
+
+    // Соединения и память освобождаются и при ошибке
+    for (int i = 0; i < clients; i++) {
+        if (c[i].fd != -1)
+            close(c[i].fd);
+    }
+    free(c);
+    free(pfds);
+    return result;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc >= 2 && strcmp(argv[1], "get") == 0)
+        return run_command(CONTROL_GET, 0);
+    if (argc >= 3 && strcmp(argv[1], "set") == 0)
+        return run_command(CONTROL_SET, strtoull(argv[2], NULL, 10));
+    if (argc >= 3 && strcmp(argv[1], "add") == 0)
+        return run_command(CONTROL_ADD, (uint64_t) strtoll(argv[2], NULL, 10));
+    if (argc >= 2 && strcmp(argv[1], "watch") == 0)
+        return run_command(CONTROL_WATCH, 0);
+    if (argc >= 2 && strcmp(argv[1], "bench") == 0) {
+        int clients = (argc >= 3) ? atoi(argv[2]) : BENCH_DEFAULT_CLIENTS;
+        long long ops = (argc >= 4) ? atoll(argv[3]) : BENCH_DEFAULT_OPS;
+        int depth = (argc >= 5) ? atoi(argv[4]) : BENCH_DEFAULT_DEPTH;
+        if (clients <= 0 || ops < clients || depth <= 0) {
+            printf("Invalid bench parameters.\n");
+            return 1;
+        }
+        return run_bench(clients, ops, depth);
+    }
+
+    printf("Usage: counter_client get | set N | add N | watch | bench [CLIENTS] [OPS] [DEPTH]\n");
+    return 1;
+}
@@ -2,6 +2,21 @@
 
 int main(int argc, char* argv[]) {
     char role = argv[1][0];
+
+    // Лидер передает уже открытые дескрипторы разделяемой памяти 
+    // в argv; если их нет, открываем объекты по имени
+    if (!attach_inherited_data(argc, argv)) {
+        data = get_data_ptr();
+        initSync();
+    }
+    if (!attach_inherited_stats(argc, argv))
+        initStats(FALSE);
+    initFastClock();
+    trace_init(role == '1' ? "copy 1" : "copy 2");
+
+    // Лидер может попросить закончить раньше (SIGTERM)
+    initShutdownSignal();
+
     switch (role) {
         case '1':
             // Копия 1
@@ -13,5 +28,9 @@ int main(int argc, char* argv[]) {
             break;
     }
 
+    trace_flush();
+    cleanupDataSync();
+    cleanupStats();
+
     return 0;
-}
\ No newline at end of file
+}
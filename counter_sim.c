@@ -0,0 +1,432 @@
+/*
+Симуляция counter на виртуальных часах. Экземпляры, выборы лидера,
+инкремент, лог и копии выполняются тем же кодом, что и в counter
+(counter.h, собранный с COUNTER_SIM), но время, PID и процессы
+виртуальные: ожиданий нет, поэтому сутки работы проигрываются за
+секунды, а одни и те же параметры дают один и тот же лог
+(counter_sim.log) до байта.
+
+    counter_sim [--hours H] [--instances K] [--kill-every MIN]
+                [--restart-after S] [--spawn-us US] [--seed N] [опции counter]
+    counter_sim --check NAME
+
+--kill-every — раз в MIN минут (со случайным сдвигом по --seed) лидер
+умирает, как от SIGKILL, и через --restart-after секунд запускается
+заново. Опции counter (--copies, --queue, --catch-up, --pacing,
+--min-interval, --max-interval) действуют как у настоящего экземпляра;
+counter.conf из текущей папки тоже читается.
+
+--check NAME — регрессионная проверка: прогон с параметрами эталона
+NAME из sim_cases, сравнение дайджеста лога и итогов с записанными.
+Код возврата 1 при расхождении. После намеренного изменения поведения
+эталоны обновляют по выводу того же прогона без --check. Запускать
+в папке без counter.conf (ctest делает это в sim_check).
+*/
+
+#include "counter.h"
+
+#define SIM_DEFAULT_HOURS 24
+#define SIM_DEFAULT_INSTANCES 1
+#define SIM_DEFAULT_RESTART 5       // in s
+#define SIM_MAX_INSTANCES 16
+
+typedef struct {
+    long pid;               // 0 — экземпляр убит и ждет перезапуска
+    counter_loop loop;
+    uint64_t wake_ns;       // следующее пробуждение основного цикла
+    uint64_t restart_ns;
+    unsigned long long wakeups;
+} sim_instance;
+
+typedef struct {
+    // Итоги по всем экземплярам, в том числе убитым
+    unsigned long long launched[2];
+    unsigned long long completed[2];
+    unsigned long long dropped[2];
+    unsigned long long wakeups;
+    unsigned long long kills;
+    unsigned long long leader_changes;
+    unsigned long long failovers;
+    double total_failover;  // in ms
+    double max_failover;    // in ms
+} sim_totals;
+
+typedef struct {
+    // Эталон для --check: параметры прогона и его итоги
+    char* name;
+    double hours;
+    int instances;
+    double kill_every;      // in min
+    unsigned int seed;
+    char* counter_options[8];
+    unsigned long long digest;
+    unsigned long long lines;
+    counter_t final_value;
+    unsigned long long leader_changes;
+    unsigned long long kills;
+    unsigned long long launched[2];
+    unsigned long long completed[2];
+    unsigned long long dropped[2];
+    unsigned long long wakeups;
+} sim_case;
+
+sim_case sim_cases[] = {
+    // Сутки одного экземпляра с настройками по умолчанию
+    { "day", 24, 1, 0, 1, { NULL },
+        0xd887af617b185974ULL, 201601, 489592, 1, 0,
+        { 28799, 28799 }, { 28799, 28799 }, { 0, 0 }, 403198 },
+    // Три экземпляра, лидера убивают примерно раз в полчаса
+    { "failover", 6, 3, 30, 7, { NULL },
+        0x170b0d42b186de06ULL, 50407, 576, 27, 13,
+        { 7196, 7196 }, { 7196, 7190 }, { 0, 0 }, 277200 },
+    // Адаптивный темп с короткой очередью: копии 2 не успевают
+    { "adaptive", 6, 2, 60, 3,
+        { "--pacing", "adaptive", "--min-interval", "200", "--max-interval", "1000", "--queue", "2" },
+        0x50eb4b21cb5d79b0ULL, 97202, 14919, 13, 6,
+        { 21601, 10803 }, { 21601, 10796 }, { 0, 10787 }, 221231 },
+};
+#define SIM_CASE_COUNT ((int) (sizeof(sim_cases) / sizeof(sim_cases[0])))
+
+sim_instance instances[SIM_MAX_INSTANCES];
+int instance_count = SIM_DEFAULT_INSTANCES;
+sim_totals totals;
+
+
+
+double wall_time() {
+    // Настоящее время (get_curr_time в симуляции виртуальное)
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e3 + now.tv_nsec / 1e6;
+}
+
+void sim_add_totals(sim_instance* inst) {
+    copy_scheduler* jobs[2] = { &inst->loop.copy_1_jobs, &inst->loop.copy_2_jobs };
+    for (int i = 0; i < 2; i++) {
+        totals.launched[i] += jobs[i]->launched;
+        totals.completed[i] += jobs[i]->completed;
+        totals.dropped[i] += jobs[i]->dropped;
+    }
+    totals.wakeups += inst->wakeups;
+}
+
+void sim_start_instance(sim_instance* inst) {
+    // То же, что начало main_counter_function
+    sim_process* p = sim_spawn(0, 0, sim_now_ns);
+    inst->pid = p->pid;
+    inst->wake_ns = sim_now_ns;
+    inst->wakeups = 0;
+
+    sim_pid = inst->pid;
+    char start_msg[] = "Main process launched.";
+    log_msg(start_msg);
+    initData();
+    refresh_config();
+    loop_init(&inst->loop, get_curr_time());
+}
+
+void sim_kill_instance(sim_instance* inst, double restart_after) {
+    // Как SIGKILL: ни выхода из цикла, ни передачи лидерства;
+    // запущенные копии доживают сиротами
+    app_info* running[2 * MAX_COPY_JOBS];
+    int count = scheduler_apps(&inst->loop.copy_1_jobs, running, MAX_COPY_JOBS);
+    count += scheduler_apps(&inst->loop.copy_2_jobs, running + count, MAX_COPY_JOBS);
+    for (int i = 0; i < count; i++)
+        close_process_handle(running[i]);
+
+    sim_add_totals(inst);
+    sim_exit(inst->pid);
+    inst->pid = 0;
+    inst->restart_ns = sim_now_ns + (uint64_t) (restart_after * 1e9);
+    totals.kills++;
+}
+
+void sim_step_instance(sim_instance* inst) {
+    // Одно пробуждение основного цикла (без сокетов и файла настроек)
+    sim_pid = inst->pid;
+    inst->wakeups++;
+    loop_elect(&inst->loop);
+    refresh_config();
+    loop_run_due(&inst->loop, get_curr_time());
+
+    // Срок переводим в ns с округлением вверх: пробуждение раньше
+    // срока колесо не обработало бы
+    double deadline = wheel_next_expiry(&inst->loop.wheel);
+    uint64_t wake = (uint64_t) (deadline * 1e6);
+    if (wake < deadline * 1e6)
+        wake++;
+    inst->wake_ns = (wake > sim_now_ns) ? wake : sim_now_ns + 1000;
+}
+
+void sim_step_copy(int index) {
+    // Шаг копии; завершение будит родителя, как SIGCHLD
+    sim_process* p = &sim_processes[index];
+    long pid = p->pid;
+    long parent = p->parent;
+    sim_pid = pid;
+
+    if (p->role == 2 && p->step == 0) {
+        int delay = copy2_begin();
+        p->step = 1;
+        p->wake_ns = sim_now_ns + (uint64_t) delay * 1000000ULL;
+        return;
+    }
+    if (p->role == 1)
+        copy1_function();
+    else
+        copy2_end(FALSE);
+    sim_exit(pid);
+
+    for (int i = 0; i < instance_count; i++) {
+        if (instances[i].pid == parent)
+            instances[i].wake_ns = sim_now_ns;
+    }
+}
+
+void sim_log_instance_stats(sim_instance* inst) {
+    // Итоговые строки лога, как при выходе counter
+    sim_pid = inst->pid;
+    double now = get_curr_time();
+    log_scheduler_stats(&inst->loop.copy_1_jobs, now);
+    log_scheduler_stats(&inst->loop.copy_2_jobs, now);
+    log_pacer_stats(&inst->loop.pacer);
+    log_task_stats(&inst->loop.wheel, &inst->loop.incr_task, "Increment");
+    log_task_stats(&inst->loop.wheel, &inst->loop.log_task, "Log");
+}
+
+uint64_t sim_kill_delay(uint64_t period, unsigned int* seed) {
+    // Пауза до следующего убийства: от половины до полутора периодов
+    return period / 2 + (uint64_t) ((double) rand_r(seed) / RAND_MAX * period);
+}
+
+unsigned long long log_digest(unsigned long long* lines) {
+    // FNV-1a по всему логу: совпадает у прогонов с одинаковыми параметрами
+    unsigned long long hash = 14695981039346656037ULL;
+    *lines = 0;
+    char log_name[NAME_SIZE];
+    FILE* f = fopen(shared_name(LOG_FILE, log_name, sizeof(log_name)), "rb");
+    if (!f)
+        return 0;
+    int c;
+    while ((c = fgetc(f)) != EOF) {
+        hash = (hash ^ (unsigned char) c) * 1099511628211ULL;
+        if (c == '\n')
+            (*lines)++;
+    }
+    fclose(f);
+    return hash;
+}
+
+BOOL check_value(char* name, unsigned long long expected, unsigned long long actual) {
+    if (expected == actual)
+        return TRUE;
+    printf("  %s: expected %llu, got %llu\n", name, expected, actual);
+    return FALSE;
+}
+
+BOOL check_case(sim_case* c, unsigned long long digest, unsigned long long lines) {
+    // Сравнивает итоги прогона с эталоном, печатает расхождения
+    BOOL ok = TRUE;
+    if (c->digest != digest) {
+        printf("  digest: expected %016llx, got %016llx\n", c->digest, digest);
+        ok = FALSE;
+    }
+    ok &= check_value("log lines", c->lines, lines);
+    ok &= check_value("final value", c->final_value, data->counter);
+    ok &= check_value("leader changes", c->leader_changes, totals.leader_changes);
+    ok &= check_value("kills", c->kills, totals.kills);
+    ok &= check_value("copy 1 launched", c->launched[0], totals.launched[0]);
+    ok &= check_value("copy 2 launched", c->launched[1], totals.launched[1]);
+    ok &= check_value("copy 1 completed", c->completed[0], totals.completed[0]);
+    ok &= check_value("copy 2 completed", c->completed[1], totals.completed[1]);
+    ok &= check_value("copy 1 dropped", c->dropped[0], totals.dropped[0]);
+    ok &= check_value("copy 2 dropped", c->dropped[1], totals.dropped[1]);
+    ok &= check_value("wakeups", c->wakeups, totals.wakeups);
+    printf("Check %s: %s.\n", c->name, ok ? "PASS" : "FAIL");
+    return ok;
+}
+
+int main(int argc, char* argv[]) {
+    double hours = SIM_DEFAULT_HOURS;
+    double kill_every = 0;      // in min, 0 — не убивать
+    double restart_after = SIM_DEFAULT_RESTART;
+    unsigned int seed = 1;
+    sim_case* check = NULL;
+
+    // Свои опции разбираем здесь, остальные — parse_options
+    char* counter_argv[64] = { argv[0] };
+    int counter_argc = 1;
+    if (argc == 3 && strcmp(argv[1], "--check") == 0) {
+        // Эталонный прогон: все параметры берутся из sim_cases
+        for (int i = 0; i < SIM_CASE_COUNT; i++) {
+            if (strcmp(argv[2], sim_cases[i].name) == 0)
+                check = &sim_cases[i];
+        }
+        if (!check) {
+            printf("Unknown check: %s.\n", argv[2]);
+            return 1;
+        }
+        FILE* conf = fopen(CONFIG_FILE, "r");
+        if (conf) {
+            fclose(conf);
+            printf("%s in the current folder would change the result.\n", CONFIG_FILE);
+            return 1;
+        }
+        hours = check->hours;
+        instance_count = check->instances;
+        kill_every = check->kill_every;
+        seed = check->seed;
+        for (int i = 0; i < 8 && check->counter_options[i]; i++)
+            counter_argv[counter_argc++] = check->counter_options[i];
+    }
+    for (int i = check ? argc : 1; i < argc; i++) {
+        if (i + 1 < argc && strcmp(argv[i], "--hours") == 0) {
+            hours = atof(argv[++i]);
+        } else if (i + 1 < argc && strcmp(argv[i], "--instances") == 0) {
+            instance_count = atoi(argv[++i]);
+        } else if (i + 1 < argc && strcmp(argv[i], "--kill-every") == 0) {
+            kill_every = atof(argv[++i]);
+        } else if (i + 1 < argc && strcmp(argv[i], "--restart-after") == 0) {
+            restart_after = atof(argv[++i]);
+        } else if (i + 1 < argc && strcmp(argv[i], "--spawn-us") == 0) {
+            sim_spawn_ns = (uint64_t) (atof(argv[++i]) * 1000);
+        } else if (i + 1 < argc && strcmp(argv[i], "--seed") == 0) {
+            seed = (unsigned int) strtoul(argv[++i], NULL, 10);
+        } else if (counter_argc < 64) {
+            counter_argv[counter_argc++] = argv[i];
+        }
+    }
+    if (!parse_options(counter_argc, counter_argv))
+        return 1;
+    if (hours <= 0 || instance_count < 1 || instance_count > SIM_MAX_INSTANCES ||
+        kill_every < 0 || restart_after < 0) {
+        printf("Usage: counter_sim [--hours H] [--instances K] [--kill-every MIN] "
+            "[--restart-after S] [--spawn-us US] [--seed N] [counter options]\n"
+            "       counter_sim --check NAME\n");
+        return 1;
+    }
+    // Потоки и сокеты в симуляции не участвуют
+    if (options.hf_rate > 0 || options.thread_copies || options.batch_path || options.metrics_port > 0) {
+        printf("--hf-rate, --exec thread, --batch and --metrics-port are not simulated.\n");
+        return 1;
+    }
+
+    // Лог каждого прогона начинается с чистого файла
+    char log_name[NAME_SIZE];
+    FILE* f = fopen(shared_name(LOG_FILE, log_name, sizeof(log_name)), "w");
+    if (f)
+        fclose(f);
+
+    double wall_start = wall_time();
+    data = get_data_ptr();
+    data->leader_pid = -1;
+    initSync();
+
+    uint64_t end_ns = sim_now_ns + (uint64_t) (hours * 3600e9);
+    uint64_t kill_period = (uint64_t) (kill_every * 60e9);
+    uint64_t next_kill = kill_period ? sim_now_ns + sim_kill_delay(kill_period, &seed) : UINT64_MAX;
+    uint64_t killed_at = 0;     // лидер убит, новый еще не выбран
+    long killed_pid = 0;
+    long last_leader = -1;
+
+    for (int i = 0; i < instance_count; i++)
+        sim_start_instance(&instances[i]);
+
+    for (;;) {
+        // Ближайшее событие: пробуждение экземпляра, шаг копии,
+        // перезапуск или очередное убийство лидера
+        uint64_t next = end_ns;
+        for (int i = 0; i < instance_count; i++) {
+            uint64_t t = instances[i].pid ? instances[i].wake_ns : instances[i].restart_ns;
+            if (t < next)
+                next = t;
+        }
+        for (int i = 0; i < sim_process_count; i++) {
+            if (sim_processes[i].role != 0 && sim_processes[i].wake_ns < next)
+                next = sim_processes[i].wake_ns;
+        }
+        if (next_kill < next)
+            next = next_kill;
+        if (next >= end_ns)
+            break;
+        sim_now_ns = next;
+
+        // Копии — раньше экземпляров: их завершение экземпляр
+        // заметит в этом же пробуждении
+        for (int i = 0; i < sim_process_count; ) {
+            int count = sim_process_count;
+            if (sim_processes[i].role != 0 && sim_processes[i].wake_ns <= sim_now_ns)
+                sim_step_copy(i);
+            if (sim_process_count == count)
+                i++;
+        }
+
+        if (sim_now_ns >= next_kill) {
+            for (int i = 0; i < instance_count; i++) {
+                if (instances[i].pid != 0 && instances[i].pid == data->leader_pid) {
+                    killed_pid = instances[i].pid;
+                    killed_at = sim_now_ns;
+                    sim_kill_instance(&instances[i], restart_after);
+                }
+            }
+            next_kill = sim_now_ns + sim_kill_delay(kill_period, &seed);
+        }
+
+        for (int i = 0; i < instance_count; i++) {
+            if (instances[i].pid == 0 && instances[i].restart_ns <= sim_now_ns)
+                sim_start_instance(&instances[i]);
+            else if (instances[i].pid != 0 && instances[i].wake_ns <= sim_now_ns)
+                sim_step_instance(&instances[i]);
+        }
+
+        // Смена лидера и время переизбрания после убийства
+        if (data->leader_pid != last_leader && process_is_alive(data->leader_pid)) {
+            last_leader = data->leader_pid;
+            totals.leader_changes++;
+            if (killed_at && last_leader != killed_pid) {
+                double failover = (sim_now_ns - killed_at) / 1e6;
+                totals.failovers++;
+                totals.total_failover += failover;
+                if (failover > totals.max_failover)
+                    totals.max_failover = failover;
+                killed_at = 0;
+            }
+        }
+    }
+    sim_now_ns = end_ns;
+
+    // Экземпляры останавливаются без дренажа копий:
+    // в лог попадают только их итоговые строки
+    for (int i = 0; i < instance_count; i++) {
+        if (instances[i].pid != 0) {
+            sim_log_instance_stats(&instances[i]);
+            sim_add_totals(&instances[i]);
+        }
+    }
+    double wall = wall_time() - wall_start;
+
+    unsigned long long lines;
+    unsigned long long digest = log_digest(&lines);
+    double sim_seconds = hours * 3600;
+    printf("Simulated %.2f h with %d instances in %.2f s (%.0fx real time).\n",
+        hours, instance_count, wall / 1000.0, sim_seconds * 1000.0 / (wall > 0 ? wall : 1));
+    printf("Counter: final value %llu.\n", data->counter);
+    printf("Leaders: %llu changes, %llu kills", totals.leader_changes, totals.kills);
+    if (totals.failovers > 0)
+        printf(", failover avg %.1f ms (max %.1f ms)",
+            totals.total_failover / totals.failovers, totals.max_failover);
+    printf(".\n");
+    for (int role = 0; role < 2; role++) {
+        printf("Copy %d: launched %llu, completed %llu, dropped %llu (%.3f launches/s).\n",
+            role + 1, totals.launched[role], totals.completed[role], totals.dropped[role],
+            totals.launched[role] / sim_seconds);
+    }
+    printf("Main loop: %llu wakeups (%.2f/s per instance).\n",
+        totals.wakeups, totals.wakeups / sim_seconds / instance_count);
+    printf("Log: %s, %llu lines (%.2f/s), digest %016llx.\n",
+        log_name, lines, lines / sim_seconds, digest);
+
+    BOOL ok = !check || check_case(check, digest, lines);
+    cleanupDataSync();
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,113 @@
+/*
+Показывает на ходу статистику задержек из /CounterStats, 
+которую ведут все экземпляры counter и их копии.
+
+    counter_stat [--interval MS] [--once] [--reset]
+
+По умолчанию раз в секунду печатает перцентили за прошедший 
+интервал и число замеров за все время. --once печатает 
+статистику за все время и выходит, --reset обнуляет ее.
+*/
+
+#include "counter.h"
+
+#define STAT_DEFAULT_INTERVAL 1000  // in ms
+
+void print_stat_header() {
+    printf("%-14s %12s %10s %10s %10s %10s %10s %10s %12s\n",
+        "metric", "total", "rate/s", "mean_us", "p50_us", "p90_us", "p99_us", "p99.9_us", "max_us");
+}
+
+void print_stat_line(stat_id id, stat_snapshot* snap, unsigned long long total, double seconds) {
+    printf("%-14s %12llu %10.1f %10.2f %10.2f %10.2f %10.2f %10.2f %12.2f\n",
+        stat_name(id), total,
+        seconds > 0 ? snap->count / seconds : 0.0,
+        snap->count ? snap->total_ns / 1e3 / snap->count : 0.0,
+        stat_percentile(snap, 50) / 1e3,
+        stat_percentile(snap, 90) / 1e3,
+        stat_percentile(snap, 99) / 1e3,
+        stat_percentile(snap, 99.9) / 1e3,
+        snap->max_ns / 1e3);
+}
+
+int main(int argc, char* argv[]) {
+    int interval = STAT_DEFAULT_INTERVAL;
+    BOOL once = FALSE;
+    BOOL reset = FALSE;
+
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 < argc && strcmp(argv[i], "--interval") == 0) {
+            interval = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--once") == 0) {
+            once = TRUE;
+        } else if (strcmp(argv[i], "--reset") == 0) {
+            reset = TRUE;
+        } else {
+            printf("Usage: counter_stat [--interval MS] [--once] [--reset]\n");
+            return 1;
+        }
+    }
+    if (interval <= 0) {
+        printf("Invalid interval.\n");
+        return 1;
+    }
+
+    // Читать можно без прав на запись; сбросу они нужны
+    if (!initStats(!reset)) {
+        printf("No statistics yet: start counter first.\n");
+        return 1;
+    }
+
+    if (reset) {
+        for (int i = 0; i < STAT_COUNT; i++) {
+            stat_histogram* h = &stats->hist[i];
+            for (int j = 0; j < STAT_BUCKETS; j++)
+                atomic_store_explicit(&h->buckets[j], 0, memory_order_relaxed);
+            atomic_store_explicit(&h->total_ns, 0, memory_order_relaxed);
+            atomic_store_explicit(&h->max_ns, 0, memory_order_relaxed);
+        }
+        for (int i = 0; i < EVENT_COUNT; i++)
+            atomic_store_explicit(&stats->events[i], 0, memory_order_relaxed);
+        printf("Statistics reset.\n");
+        cleanupStats();
+        return 0;
+    }
+
+    stat_snapshot* before = (stat_snapshot*) malloc(STAT_COUNT * sizeof(stat_snapshot));
+    stat_snapshot* now = (stat_snapshot*) malloc(STAT_COUNT * sizeof(stat_snapshot));
+    stat_snapshot diff;
+    double start = get_curr_time();
+
+    for (int i = 0; i < STAT_COUNT; i++)
+        stat_snapshot_take(&stats->hist[i], &before[i]);
+
+    if (once) {
+        // Все время жизни сегмента; частоту посчитать не из чего
+        print_stat_header();
+        for (int i = 0; i < STAT_COUNT; i++)
+            print_stat_line((stat_id) i, &before[i], before[i].count, 0);
+    }
+
+    while (!once) {
+        sleep_ms(interval);
+        double elapsed = (get_curr_time() - start) / 1000.0;
+        start = get_curr_time();
+
+        char* time_str = get_time_str();
+        printf("\n[%s]\n", time_str);
+        free(time_str);
+        print_stat_header();
+        for (int i = 0; i < STAT_COUNT; i++) {
+            stat_snapshot_take(&stats->hist[i], &now[i]);
+            stat_snapshot_diff(&now[i], &before[i], &diff);
+            print_stat_line((stat_id) i, &diff, now[i].count, elapsed);
+            before[i] = now[i];
+        }
+        fflush(stdout);
+    }
+
+    free(before);
+    free(now);
+    cleanupStats();
+    return 0;
+}
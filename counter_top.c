@@ -0,0 +1,236 @@
+/*
+Живая сводка о работе counter в терминале. Подключается к /SharedData
+и /CounterStats только на чтение и не берет блокировку, не трогает
+counter.log, поэтому ее можно держать открытой на нагруженной машине.
+
+    counter_top [--interval MS] [--once]
+
+По умолчанию обновляется 4 раза в секунду; --once печатает
+одну сводку (темпы — за первый интервал) и выходит.
+*/
+
+#include "counter.h"
+
+#ifdef _WIN32
+    #include <tlhelp32.h>
+#else
+    #include <dirent.h>
+#endif
+
+#define TOP_DEFAULT_INTERVAL 250    // in ms
+#define TOP_SCAN_INTERVAL 1000      // in ms, как часто пересчитывать процессы
+
+typedef struct {
+    double taken_at;            // in ms
+    counter_t value;
+    metrics_snapshot m;         // события и счетчики статистики
+    stat_snapshot lock_wait;
+    stat_snapshot log_write;
+} top_sample;
+
+typedef struct {
+    int instances;              // -1 — посчитать не удалось
+    int copies;
+} top_processes;
+
+
+
+void count_processes(top_processes* p) {
+    // Экземпляры и копии-процессы по именам (копии-потоки не видны)
+    p->instances = 0;
+    p->copies = 0;
+#ifdef _WIN32
+    HANDLE snapshot = CreateToolhelp32Snapshot(TH32CS_SNAPPROCESS, 0);
+    if (snapshot == INVALID_HANDLE_VALUE) {
+        p->instances = p->copies = -1;
+        return;
+    }
+    PROCESSENTRY32 entry;
+    entry.dwSize = sizeof(entry);
+    for (BOOL ok = Process32First(snapshot, &entry); ok; ok = Process32Next(snapshot, &entry)) {
+        if (_stricmp(entry.szExeFile, "counter.exe") == 0)
+            p->instances++;
+        else if (_stricmp(entry.szExeFile, "counter_daughter.exe") == 0)
+            p->copies++;
+    }
+    CloseHandle(snapshot);
+#else // POSIX
+    DIR* d = opendir("/proc");
+    if (!d) {
+        p->instances = p->copies = -1;
+        return;
+    }
+    struct dirent* entry;
+    while ((entry = readdir(d)) != NULL) {
+        if (!isdigit((unsigned char) entry->d_name[0]))
+            continue;
+        char path[sizeof(entry->d_name) + 16];  // "/proc/" + имя + "/comm"
+        snprintf(path, sizeof(path), "/proc/%s/comm", entry->d_name);
+        FILE* f = fopen(path, "r");
+        if (!f)
+            continue;
+        char comm[32] = "";
+        BOOL ok = fgets(comm, sizeof(comm), f) != NULL;
+        fclose(f);
+        if (!ok)
+            continue;
+        // comm обрезан до 15 символов: counter_daughter -> counter_daughte
+        if (strcmp(comm, "counter\n") == 0)
+            p->instances++;
+        else if (strcmp(comm, "counter_daughte\n") == 0)
+            p->copies++;
+    }
+    closedir(d);
+#endif
+}
+
+void take_sample(top_sample* s) {
+    // Без lockData: counter читается атомарно, статистика —
+    // relaxed-атомиками (так же собирает снимок /metrics)
+    s->taken_at = get_curr_time();
+    s->value = shared_counter_load(data);
+    metrics_refresh(s->taken_at);
+    s->m = metrics;
+    memset(&s->lock_wait, 0, sizeof(s->lock_wait));
+    memset(&s->log_write, 0, sizeof(s->log_write));
+    if (stats) {
+        stat_snapshot_take(&stats->hist[STAT_LOCK_WAIT], &s->lock_wait);
+        stat_snapshot_take(&stats->hist[STAT_LOG_WRITE], &s->log_write);
+    }
+}
+
+unsigned long long event_delta(top_sample* now, top_sample* before, event_id id) {
+    // После counter_stat --reset счетчики уменьшаются — тогда 0
+    unsigned long long a = now->m.events[id];
+    unsigned long long b = before->m.events[id];
+    return a >= b ? a - b : 0;
+}
+
+void format_duration(double seconds, char* buf, size_t size) {
+    unsigned long long s = (unsigned long long) seconds;
+    if (s >= 86400)
+        snprintf(buf, size, "%llud %02lluh%02llum", s / 86400, s / 3600 % 24, s / 60 % 60);
+    else
+        snprintf(buf, size, "%lluh%02llum%02llus", s / 3600, s / 60 % 60, s % 60);
+}
+
+void print_screen(top_sample* now, top_sample* before, top_processes* procs, int interval, BOOL clear) {
+    double seconds = (now->taken_at - before->taken_at) / 1000.0;
+    if (seconds <= 0)
+        seconds = interval / 1000.0;
+
+    if (clear)
+        printf("\033[H\033[2J");
+    char* time_str = get_time_str();
+    printf("counter_top  every %d ms  %s\n\n", interval, time_str);
+    free(time_str);
+
+    // Значение и темп. Темп значения учитывает и копии, и ввод
+    // (может быть отрицательным), темп инкрементов — только инкременты
+    printf("Value       %-20llu change %+.1f/s, increments %.1f/s\n", now->value,
+        ((double) now->value - (double) before->value) / seconds,
+        event_delta(now, before, EVENT_INCREMENTS) / seconds);
+
+    // Лидер
+    long leader = data->leader_pid;
+    if (leader > 0 && process_is_alive(leader)) {
+        char uptime[32];
+        uint64_t since = atomic_load(&data->leader_since_ns);
+        uint64_t curr = get_curr_time_ns();
+        format_duration(since && curr > since ? (curr - since) / 1e9 : 0, uptime, sizeof(uptime));
+        printf("Leader      PID %-16ld leader for %s, %llu changes\n", leader, uptime,
+            now->m.events[EVENT_LEADER_CHANGES]);
+    } else {
+        printf("Leader      none (PID %ld is not running), %llu changes\n", leader,
+            now->m.events[EVENT_LEADER_CHANGES]);
+    }
+
+    // Копии в работе считаем по процессам, а не как "запущено минус 
+    // собрано": копии убитого лидера никто не соберет
+    if (procs->instances >= 0)
+        printf("Instances   %-20d copy jobs in flight %d\n", procs->instances, procs->copies);
+    else
+        printf("Instances   unknown\n");
+
+    for (int role = 0; role < 2; role++) {
+        printf("Copy %d      launched %llu (%.2f/s), completed %llu, dropped %llu\n",
+            role + 1, now->m.events[EVENT_COPY1_LAUNCHED + role],
+            event_delta(now, before, EVENT_COPY1_LAUNCHED + role) / seconds,
+            now->m.events[EVENT_COPY1_COMPLETED + role], now->m.events[EVENT_COPY1_DROPPED + role]);
+    }
+    printf("            launch deadlines with copies still busy: %llu\n",
+        now->m.events[EVENT_LAUNCH_BUSY]);
+
+    // Блокировка за интервал
+    stat_snapshot diff;
+    stat_snapshot_diff(&now->lock_wait, &before->lock_wait, &diff);
+    unsigned long long contended = diff.count - diff.buckets[0];
+    printf("Lock        %.1f acquisitions/s, contended %.2f%%, wait avg %.2f us, p99 %.2f us, "
+        "recoveries %llu\n",
+        diff.count / seconds, diff.count ? 100.0 * contended / diff.count : 0.0,
+        contended ? diff.total_ns / 1e3 / contended : 0.0,
+        stat_percentile(&diff, 99) / 1e3, now->m.events[EVENT_LOCK_RECOVERIES]);
+
+    // Лог за интервал
+    stat_snapshot_diff(&now->log_write, &before->log_write, &diff);
+    printf("Log         %.1f lines/s, %.0f bytes/s, write p50 %.1f us, p99 %.1f us\n",
+        diff.count / seconds, event_delta(now, before, EVENT_LOG_BYTES) / seconds,
+        stat_percentile(&diff, 50) / 1e3, stat_percentile(&diff, 99) / 1e3);
+
+    if (!stats)
+        printf("\n(no /CounterStats: rates and copy counts are unavailable)\n");
+    fflush(stdout);
+}
+
+int main(int argc, char* argv[]) {
+    int interval = TOP_DEFAULT_INTERVAL;
+    BOOL once = FALSE;
+
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 < argc && strcmp(argv[i], "--interval") == 0) {
+            interval = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--once") == 0) {
+            once = TRUE;
+        } else {
+            printf("Usage: counter_top [--interval MS] [--once]\n");
+            return 1;
+        }
+    }
+    if (interval <= 0) {
+        printf("Invalid interval.\n");
+        return 1;
+    }
+
+    if (!get_data_ptr_read_only()) {
+        printf("No shared data yet: start counter first.\n");
+        return 1;
+    }
+    initStats(TRUE);    // без статистики сводка будет неполной, но работает
+
+    top_sample samples[2];
+    top_processes procs;
+    int current = 0;
+    take_sample(&samples[current]);
+    count_processes(&procs);
+    double last_scan = get_curr_time();
+
+    for (;;) {
+        sleep_ms(interval);
+        current ^= 1;
+        take_sample(&samples[current]);
+
+        // Обход процессов дороже всего остального, поэтому реже
+        if (samples[current].taken_at - last_scan >= TOP_SCAN_INTERVAL) {
+            count_processes(&procs);
+            last_scan = samples[current].taken_at;
+        }
+
+        print_screen(&samples[current], &samples[current ^ 1], &procs, interval, !once);
+        if (once)
+            break;
+    }
+
+    cleanupStats();
+    cleanupDataSync();
+    return 0;
+}
@@ -0,0 +1,161 @@
+/*
+Собирает файлы трассировки, которые пишут counter и копии при
+запуске с переменной окружения COUNTER_TRACE=DIR, в один JSON
+формата Trace Event (открывается в chrome://tracing и Perfetto).
+
+    counter_trace [DIR] [OUT]
+
+DIR — папка с файлами trace-PID.bin (по умолчанию текущая),
+OUT — итоговый файл (по умолчанию trace.json). Файлы прошлых
+запусков тоже попадут в трассировку, поэтому папку лучше брать новую.
+*/
+
+#include "counter.h"
+
+#ifndef _WIN32
+    #include <dirent.h>
+#endif
+
+#define TRACE_DEFAULT_OUT "trace.json"
+
+typedef struct {
+    trace_file_header header;
+    trace_event* events;
+} trace_file;
+
+BOOL read_trace_file(char* path, trace_file* t) {
+    FILE* f = fopen(path, "rb");
+    if (!f)
+        return FALSE;
+
+    BOOL ok = fread(&t->header, sizeof(t->header), 1, f) == 1 && t->header.magic == TRACE_MAGIC;
+    t->events = NULL;
+    if (ok && t->header.count > 0) {
+        t->events = (trace_event*) malloc((size_t) t->header.count * sizeof(trace_event));
+        ok = t->events &&
+            fread(t->events, sizeof(trace_event), (size_t) t->header.count, f) == t->header.count;
+    }
+    fclose(f);
+
+    if (!ok) {
+        free(t->events);
+        printf("Skipping %s: not a complete trace file.\n", path);
+    }
+    return ok;
+}
+
+int list_trace_files(char* dir, trace_file** files) {
+    // Читает все trace-*.bin из dir, возвращает их число
+    int count = 0;
+    int capacity = 16;
+    *files = (trace_file*) malloc(capacity * sizeof(trace_file));
+    char path[1024];
+
+#ifdef _WIN32
+    snprintf(path, sizeof(path), "%s\\trace-*.bin", dir);
+    WIN32_FIND_DATAA found;
+    HANDLE hFind = FindFirstFileA(path, &found);
+    if (hFind == INVALID_HANDLE_VALUE)
+        return 0;
+    do {
+        char* name = found.cFileName;
+#else // POSIX
+    DIR* d = opendir(dir);
+    if (!d)
+        return 0;
+    struct dirent* entry;
+    while ((entry = readdir(d)) != NULL) {
+        char* name = entry->d_name;
+        size_t len = strlen(name);
+        if (strncmp(name, "trace-", 6) != 0 || len < 4 || strcmp(name + len - 4, ".bin") != 0)
+            continue;
+#endif
+
+        if (count == capacity) {
+            capacity *= 2;
+            *files = (trace_file*) realloc(*files, capacity * sizeof(trace_file));
+        }
+        snprintf(path, sizeof(path), "%s/%s", dir, name);
+        if (read_trace_file(path, &(*files)[count]))
+            count++;
+
+#ifdef _WIN32
+    } while (FindNextFileA(hFind, &found));
+    FindClose(hFind);
+#else // POSIX
+    }
+    closedir(d);
+#endif
+
+    return count;
+}
+
+int main(int argc, char* argv[]) {
+    char* dir = argc > 1 ? argv[1] : ".";
+    char* out_path = argc > 2 ? argv[2] : TRACE_DEFAULT_OUT;
+    if (argc > 3 || (argc > 1 && argv[1][0] == '-')) {
+        printf("Usage: counter_trace [DIR] [OUT]\n");
+        return 1;
+    }
+
+    trace_file* files;
+    int count = list_trace_files(dir, &files);
+    if (count == 0) {
+        printf("No trace files in %s: run counter with %s=%s first.\n", dir, TRACE_ENV, dir);
+        free(files);
+        return 1;
+    }
+
+    // Время отсчитываем от самого раннего события
+    uint64_t origin = UINT64_MAX;
+    for (int i = 0; i < count; i++) {
+        for (uint64_t j = 0; j < files[i].header.count; j++) {
+            if (files[i].events[j].start_ns < origin)
+                origin = files[i].events[j].start_ns;
+        }
+    }
+
+    FILE* out = fopen(out_path, "w");
+    if (!out) {
+        perror("Couldn't open the output file!");
+        return 1;
+    }
+
+    fprintf(out, "{\"traceEvents\":[\n");
+    BOOL first = TRUE;
+    unsigned long long total = 0;
+    unsigned long long dropped = 0;
+    for (int i = 0; i < count; i++) {
+        trace_file_header* h = &files[i].header;
+        fprintf(out, "%s{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%u,\"args\":{\"name\":\"%s (%u)\"}}",
+            first ? "" : ",\n", h->pid, h->role, h->pid);
+        first = FALSE;
+
+        for (uint64_t j = 0; j < h->count; j++) {
+            trace_event* e = &files[i].events[j];
+            double ts = (e->start_ns - origin) / 1e3;   // in us
+            if (e->kind == TRACE_LAUNCH_BUSY) {
+                fprintf(out, ",\n{\"name\":\"%s\",\"cat\":\"counter\",\"ph\":\"i\",\"s\":\"p\","
+                    "\"ts\":%.3f,\"pid\":%u,\"tid\":%u}",
+                    trace_kind_name((trace_kind) e->kind), ts, h->pid, e->tid);
+            } else {
+                fprintf(out, ",\n{\"name\":\"%s\",\"cat\":\"counter\",\"ph\":\"X\","
+                    "\"ts\":%.3f,\"dur\":%.3f,\"pid\":%u,\"tid\":%u,\"args\":{\"value\":%llu}}",
+                    trace_kind_name((trace_kind) e->kind), ts, e->dur_ns / 1e3, h->pid, e->tid,
+                    (unsigned long long) e->value);
+            }
+        }
+        total += h->count;
+        dropped += h->dropped;
+        free(files[i].events);
+    }
+    fprintf(out, "\n]}\n");
+    fclose(out);
+    free(files);
+
+    printf("Merged %llu events from %d processes into %s", total, count, out_path);
+    if (dropped > 0)
+        printf(" (%llu events dropped: buffers were full)", dropped);
+    printf(".\n");
+    return 0;
+}
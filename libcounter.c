@@ -0,0 +1,149 @@
+#define COUNTER_DECLS_ONLY
+#include "counter.h"
+#include "libcounter.h"
+
+#ifndef _WIN32
+    #include <sys/stat.h>
+#endif
+
+#ifdef _WIN32
+    static HANDLE lib_hMap = NULL;
+    static HANDLE lib_hMutex = NULL;
+#else // POSIX
+    static int lib_shm_fd = -1;
+#endif
+static SharedData* lib_data = NULL;
+
+static int lib_lock(void) {
+    // Тот же протокол, что у lockData/unlockData в counter.h. 
+    // 0 — блокировка наша, -1 — не получена (отпускать нечего)
+#ifdef _WIN32
+    // WAIT_ABANDONED тоже означает, что мьютекс наш
+    DWORD result = WaitForSingleObject(lib_hMutex, INFINITE);
+    if (result != WAIT_OBJECT_0 && result != WAIT_ABANDONED)
+        return -1;
+#else // POSIX
+    if (shared_lock_acquire(lib_data, FALSE, NULL) != 0)
+        return -1;
+    // pid не кэшируем: после fork у потомка он другой
+    atomic_store_explicit(&lib_data->lock_owner, (long) getpid(), memory_order_relaxed);
+#endif
+    return 0;
+}
+
+static void lib_unlock(void) {
+#ifdef _WIN32
+    ReleaseMutex(lib_hMutex);
+#else // POSIX
+    atomic_store_explicit(&lib_data->lock_owner, 0, memory_order_relaxed);
+    pthread_mutex_unlock(&lib_data->lock);
+#endif
+}
+
+int counter_open(void) {
+    if (lib_data)
+        return 0;
+
+#ifdef _WIN32
+
+    char name[NAME_SIZE];
+    lib_hMap = OpenFileMapping(FILE_MAP_ALL_ACCESS, FALSE, shared_name("SharedData", name, sizeof(name)));
+    if (!lib_hMap)
+        return -1;
+    lib_data = (SharedData*) MapViewOfFile(lib_hMap, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(SharedData));
+    lib_hMutex = OpenMutex(SYNCHRONIZE | MUTEX_MODIFY_STATE, FALSE, shared_name("DataMutex", name, sizeof(name)));
+    if (!lib_data || !lib_hMutex) {
+        counter_close();
+        return -1;
+    }
+
+#else // POSIX
+
+    // Без O_CREAT: объекты создает только counter
+    char name[NAME_SIZE];
+    lib_shm_fd = shm_open(shared_name("/SharedData", name, sizeof(name)), O_RDWR | O_CLOEXEC, 0);
+    if (lib_shm_fd == -1)
+        return -1;
+
+    struct stat st;
+    if (fstat(lib_shm_fd, &st) == -1 || st.st_size < (off_t) sizeof(SharedData)) {
+        counter_close();
+        return -1;
+    }
+
+    void* ptr = mmap(NULL, sizeof(SharedData), PROT_READ | PROT_WRITE, MAP_SHARED, lib_shm_fd, 0);
+    if (ptr == MAP_FAILED) {
+        counter_close();
+        return -1;
+    }
+    lib_data = (SharedData*) ptr;
+
+    // Мьютекс создает counter в initSync
+    if (!shared_lock_ready(lib_data, FALSE)) {
+        counter_close();
+        return -1;
+    }
+
+#endif
+    return 0;
+}
+
+void counter_close(void) {
+#ifdef _WIN32
+    if (lib_hMutex) {
+        CloseHandle(lib_hMutex);
+        lib_hMutex = NULL;
+    }
+    if (lib_data) {
+        UnmapViewOfFile(lib_data);
+        lib_data = NULL;
+    }
+    if (lib_hMap) {
+        CloseHandle(lib_hMap);
+        lib_hMap = NULL;
+    }
+#else // POSIX
+    if (lib_data) {
+        munmap(lib_data, sizeof(SharedData));
+        lib_data = NULL;
+    }
+    if (lib_shm_fd >= 0) {
+        close(lib_shm_fd);
+        lib_shm_fd = -1;
+    }
+#endif
+}
+
+uint64_t counter_get(void) {
+    return shared_counter_load(lib_data);
+}
+
+int counter_add(int64_t delta, uint64_t* value) {
+    if (lib_lock() == -1)
+        return -1;
+    lib_data->counter += (counter_t) delta;
+    uint64_t current = lib_data->counter;
+    lib_unlock();
+    shared_counter_changed(lib_data);
+    if (value)
+        *value = current;
+    return 0;
+}
+
+int counter_set(uint64_t value) {
+    if (lib_lock() == -1)
+        return -1;
+    lib_data->counter = value;
+    lib_unlock();
+    shared_counter_changed(lib_data);
+    return 0;
+}
+
+int counter_wait_change(uint64_t last, uint64_t* value, int timeout_ms) {
+    // Ждет на futex-слове SharedData::change_seq, без опроса
+    counter_t current;
+    BOOL changed = shared_counter_wait(lib_data, last, &current, timeout_ms);
+    if (value)
+        *value = current;
+    return changed ? 1 : 0;
+}
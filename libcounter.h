@@ -0,0 +1,46 @@
+/*
+libcounter — доступ к счетчику из других программ без запуска counter.
+
+Библиотека отображает ту же разделяемую память /SharedData и 
+использует тот же мьютекс в ней (на Windows — "SharedData" и 
+мьютекс "DataMutex"), что и counter, поэтому ее изменения видны 
+всем экземплярам и наоборот. Хотя бы один counter должен быть 
+запущен раньше: библиотека объекты не создает.
+
+Чтение не берет блокировку и стоит несколько наносекунд; 
+изменение — одна пара lock/unlock, как в самом counter.
+*/
+
+#ifndef LIBCOUNTER_H
+#define LIBCOUNTER_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Подключается к счетчику. 0 — успех, -1 — ошибка (counter не запускался)
+int counter_open(void);
+// Отключается от счетчика
+void counter_close(void);
+
+// Остальные функции можно вызывать только после успешного counter_open
+
+// Текущее значение счетчика (без блокировки)
+uint64_t counter_get(void);
+// Прибавляет delta (может быть отрицательным), новое значение кладет 
+// в *value (если value не NULL). 0 — успех, -1 — блокировка не получена
+int counter_add(int64_t delta, uint64_t* value);
+// Устанавливает значение счетчика. 0 — успех, -1 — блокировка не получена
+int counter_set(uint64_t value);
+// Ждет, пока значение станет отличным от last, но не дольше 
+// timeout_ms (-1 — без ограничения). Новое значение кладет в *value. 
+// 1 — значение изменилось, 0 — истек таймаут
+int counter_wait_change(uint64_t last, uint64_t* value, int timeout_ms);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LIBCOUNTER_H